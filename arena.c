@@ -0,0 +1,85 @@
+/*
+ * Bump allocator over mmap'd blocks (see arena.h).
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size; /* whole mapping, header included */
+};
+
+struct arena {
+    char *cur;
+    char *end;
+    size_t grow; /* size used for overflow blocks */
+    struct arena_block *blocks;
+};
+
+static size_t round_to_pages(size_t n) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (n + page - 1) & ~(page - 1);
+}
+
+static struct arena_block *map_block(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    struct arena_block *b = p;
+    b->next = NULL;
+    b->size = size;
+    return b;
+}
+
+struct arena *arena_create(size_t initial_cap) {
+    size_t size = round_to_pages(initial_cap + sizeof(struct arena_block) +
+                                 sizeof(struct arena));
+    struct arena_block *b = map_block(size);
+    if (b == NULL) return NULL;
+
+    /* Bookkeeping lives at the front of the first block. */
+    struct arena *a = (struct arena *)(b + 1);
+    a->cur = (char *)(a + 1);
+    a->end = (char *)b + size;
+    a->grow = size;
+    a->blocks = b;
+    return a;
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+    a->cur = (char *)(((uintptr_t)a->cur + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+
+    if ((size_t)(a->end - a->cur) < size) {
+        size_t need = round_to_pages(size + sizeof(struct arena_block) + ARENA_ALIGN);
+        if (need < a->grow) need = a->grow;
+        struct arena_block *b = map_block(need);
+        if (b == NULL) return NULL;
+        b->next = a->blocks;
+        a->blocks = b;
+        a->cur = (char *)(b + 1);
+        a->end = (char *)b + need;
+        a->cur = (char *)(((uintptr_t)a->cur + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+    }
+
+    void *p = a->cur;
+    a->cur += size;
+    return p;
+}
+
+void arena_destroy(struct arena *a) {
+    struct arena_block *b = a->blocks;
+    /* The arena struct sits inside one of the blocks, so grab each next
+     * pointer before the munmap that may take the struct with it. */
+    while (b != NULL) {
+        struct arena_block *next = b->next;
+        munmap(b, b->size);
+        b = next;
+    }
+}
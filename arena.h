@@ -0,0 +1,31 @@
+/*
+ * Connection-scoped arena allocator.
+ *
+ * An arena is created when a connection is accepted and destroyed
+ * wholesale at disconnect: allocations are a pointer bump, there is no
+ * per-object free, and teardown is one munmap per block (almost always
+ * exactly one). Keeping a connection's buffers, peer string and parser
+ * state in one mapping also keeps its hot data local.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena;
+
+/* Create an arena with the given initial capacity (rounded up to whole
+ * pages; the arena bookkeeping lives inside the mapping). Returns NULL
+ * if the mapping fails. */
+struct arena *arena_create(size_t initial_cap);
+
+/* Bump-allocate size bytes, 16-byte aligned. Falls back to mapping an
+ * additional block if the current one is exhausted; returns NULL only
+ * if that mapping fails. */
+void *arena_alloc(struct arena *a, size_t size);
+
+/* Unmap every block. All pointers from arena_alloc() become invalid. */
+void arena_destroy(struct arena *a);
+
+#endif /* ARENA_H */
@@ -0,0 +1,92 @@
+#!/bin/sh
+# Benchmark matrix for the echo server: runs the client's load-generation
+# mode (client -B) across message sizes and connection counts against a
+# locally started server, and appends one CSV row per cell to
+# bench-results.csv. If bench-baseline.csv exists (make bench-baseline),
+# the run ends with a per-cell throughput comparison so a change can be
+# judged as a number, not an impression.
+#
+# Every knob is an environment variable so a single cell can be rerun in
+# isolation, e.g.:
+#   BENCH_MODE=uring BENCH_SIZES=1048576 BENCH_CONNS=10 make bench
+set -u
+
+BENCH_PORT=${BENCH_PORT:-5599}
+BENCH_SERVER=${BENCH_SERVER:-./server}
+BENCH_MODE=${BENCH_MODE:-epoll}
+BENCH_SIZES=${BENCH_SIZES:-"64 1024 16384 262144 1048576"}
+BENCH_CONNS=${BENCH_CONNS:-"1 10 100 1000 10000"}
+BENCH_DEPTH=${BENCH_DEPTH:-8}
+# Per-cell byte budget: messages per connection are scaled so each cell
+# echoes roughly this much, keeping the 1MB x 10k cell as affordable as
+# the 64B x 1 cell.
+BENCH_BYTES=${BENCH_BYTES:-268435456}
+
+RESULTS=bench-results.csv
+BASELINE=bench-baseline.csv
+
+FD_LIMIT=$(ulimit -n)
+
+echo "mode,size,conns,depth,msgs_per_conn,msg_per_s,mb_per_s,p50_us,p95_us,p99_us,p999_us" > "$RESULTS"
+
+SERVER_PID=""
+cleanup() {
+    [ -n "$SERVER_PID" ] && kill "$SERVER_PID" 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+for size in $BENCH_SIZES; do
+    # The server buffers one full message per read; give it headroom
+    # over the largest frame in this column.
+    "$BENCH_SERVER" -m "$BENCH_MODE" -l 0 -b $((size + 8192)) "$BENCH_PORT" \
+        > /dev/null 2>&1 &
+    SERVER_PID=$!
+    sleep 0.5
+
+    for conns in $BENCH_CONNS; do
+        if [ $((conns + 64)) -gt "$FD_LIMIT" ]; then
+            echo "skip: size=$size conns=$conns (fd limit $FD_LIMIT)" >&2
+            continue
+        fi
+
+        msgs=$((BENCH_BYTES / (size * conns)))
+        [ "$msgs" -lt 10 ] && msgs=10
+        [ "$msgs" -gt 100000 ] && msgs=100000
+
+        out=$(./client -B -c "$conns" -n "$msgs" -s "$size" -p "$BENCH_DEPTH" \
+                  127.0.0.1 "$BENCH_PORT") || {
+            echo "fail: size=$size conns=$conns" >&2
+            continue
+        }
+        echo "$out" | sed 's/^/    /' >&2
+
+        echo "$out" | awk -v mode="$BENCH_MODE" -v size="$size" \
+                          -v conns="$conns" -v depth="$BENCH_DEPTH" -v msgs="$msgs" '
+            /^throughput:/ { thr = $2; mbs = $4 }
+            /^latency:/    { p50 = $3; p95 = $6; p99 = $9; p999 = $12 }
+            END { printf "%s,%d,%d,%d,%d,%s,%s,%s,%s,%s,%s\n",
+                  mode, size, conns, depth, msgs, thr, mbs, p50, p95, p99, p999 }
+        ' >> "$RESULTS"
+    done
+
+    kill "$SERVER_PID" 2>/dev/null
+    wait "$SERVER_PID" 2>/dev/null
+    SERVER_PID=""
+done
+
+echo "results: $RESULTS"
+
+if [ -f "$BASELINE" ]; then
+    echo "throughput vs baseline ($BASELINE):"
+    awk -F, '
+        NR == FNR { if (FNR > 1) base[$1","$2","$3] = $6; next }
+        FNR > 1 {
+            key = $1","$2","$3
+            if (key in base && base[key] + 0 > 0)
+                printf "  %-28s %12s msg/s  %+7.1f%%\n",
+                       key, $6, ($6 - base[key]) / base[key] * 100
+        }
+    ' "$BASELINE" "$RESULTS"
+else
+    echo "no $BASELINE; run 'make bench-baseline' to store this run as the baseline"
+fi
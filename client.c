@@ -1,23 +1,61 @@
 /*
  * TCP client with interactive loop (send multiple messages)
  *
- * Build: gcc -Wall -Wextra -O2 client_loop.c -o client
- * Run:   ./client <server_ip_or_hostname> <port>
+ * Build: make  (or: gcc -Wall -Wextra -O2 -pthread client.c -o client)
+ * Run:   ./client [-U] <server_ip_or_hostname> <port>
+ *        ./client [-B ...] <socket-path>
+ *        ./client -B [-E|-U] [-c conns] [-n msgs] [-s size] [-p depth]
+ *                 [-W warmup] <host> <port>
  *
  * Usage:
  * - Type a line and press Enter to send
  * - Type "quit" or "exit" to close the connection
+ *
+ * Benchmark mode (-B): opens -c concurrent connections (one thread each),
+ * sends -n messages of -s bytes per connection with -p requests kept in
+ * flight (1 = ping-pong), and reports throughput plus a latency histogram
+ * (p50/p95/p99/p999) built from HDR-style log-linear buckets. All
+ * connections are established up front as a pool, ramped in small batches
+ * so a big -c does not SYN-flood the listen backlog, and connect times
+ * get their own histogram so an accept-path regression is visible
+ * separately from an echo-path one. -W runs that many messages per
+ * connection over the pooled sockets before measurement starts, leaving
+ * cold caches and TCP slow start out of the latency numbers.
+ *
+ * With -E the connections run nonblocking under a single epoll loop
+ * instead of one thread each, so very large connection counts cost one
+ * event loop rather than thousands of blocking threads. Send timestamps
+ * are still taken per request, so the histogram is the same.
+ *
+ * With -U traffic goes over UDP (the server's "-m udp" mode): each
+ * message is one datagram, and the benchmark batches a pipeline window's
+ * worth of packets into single sendmmsg()/recvmmsg() calls. Replies that
+ * fail to arrive within a second are counted as lost rather than waited
+ * for, since datagrams carry no delivery promise.
+ *
+ * A single positional argument is taken as an AF_UNIX socket path (the
+ * server bound with a path instead of a port); everything else -- the
+ * interactive loop and the benchmark -- works unchanged over it.
  */
 
+#define _GNU_SOURCE /* sendmmsg/recvmmsg */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-#include <errno.h>
-#include <sys/types.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
-#include <netinet/in.h>
-#include <netdb.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
 static void die(const char *msg) {
     perror(msg);
@@ -62,31 +100,35 @@ static ssize_t recv_some(int fd, char *buf, size_t cap) {
     }
 }
 
-int main(int argc, char *argv[]) {
-    int sockfd;
-    int portno;
-    struct sockaddr_in serv_addr;
-    struct hostent *server;
-
-    char buffer[256];
-    char reply[256];
-
-    if (argc < 3) {
-        fprintf(stderr, "usage: %s hostname port\n", argv[0]);
-        exit(1);
+/* portno < 0 means host is an AF_UNIX socket path. */
+static int connect_to(const char *host, int portno, int dgram) {
+    if (portno < 0) {
+        struct sockaddr_un serv_addr;
+        if (strlen(host) >= sizeof(serv_addr.sun_path)) {
+            fprintf(stderr, "ERROR, socket path too long\n");
+            exit(1);
+        }
+        int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sockfd < 0) die("ERROR opening socket");
+        memset(&serv_addr, 0, sizeof(serv_addr));
+        serv_addr.sun_family = AF_UNIX;
+        strcpy(serv_addr.sun_path, host);
+        if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+            die("ERROR connecting");
+        }
+        return sockfd;
     }
 
-    portno = atoi(argv[2]);
-
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    int sockfd = socket(AF_INET, dgram ? SOCK_DGRAM : SOCK_STREAM, 0);
     if (sockfd < 0) die("ERROR opening socket");
 
-    server = gethostbyname(argv[1]);
+    struct hostent *server = gethostbyname(host);
     if (server == NULL) {
         fprintf(stderr, "ERROR, no such host\n");
         exit(1);
     }
 
+    struct sockaddr_in serv_addr;
     memset(&serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
     memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, (size_t)server->h_length);
@@ -96,6 +138,669 @@ int main(int argc, char *argv[]) {
         die("ERROR connecting");
     }
 
+    return sockfd;
+}
+
+/* ---- benchmark mode ---- */
+
+/* The server prefixes every echo with this ack line, so a reply to an
+ * s-byte message is exactly strlen(header) + s bytes. */
+static const char bench_reply_header[] = "I got your message\n";
+
+/*
+ * HDR-style log-linear histogram of nanosecond latencies: 32 sub-buckets
+ * per power of two, so relative error stays around 3% across the whole
+ * range without storing every sample.
+ */
+#define HIST_SUBBITS 5
+#define HIST_BUCKETS ((64 - HIST_SUBBITS + 1) << HIST_SUBBITS)
+
+struct hist {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+};
+
+static unsigned hist_index(uint64_t v) {
+    if (v < (1u << HIST_SUBBITS)) return (unsigned)v;
+    unsigned msb = 63 - (unsigned)__builtin_clzll(v);
+    unsigned shift = msb - HIST_SUBBITS;
+    return ((shift + 1) << HIST_SUBBITS) +
+           (unsigned)((v >> shift) & ((1u << HIST_SUBBITS) - 1));
+}
+
+static void hist_record(struct hist *h, uint64_t v) {
+    h->counts[hist_index(v)]++;
+    h->total++;
+}
+
+static void hist_merge(struct hist *into, const struct hist *from) {
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) into->counts[i] += from->counts[i];
+    into->total += from->total;
+}
+
+/* Midpoint of the bucket's value range */
+static uint64_t hist_bucket_value(unsigned idx) {
+    if (idx < (1u << HIST_SUBBITS)) return idx;
+    unsigned shift = (idx >> HIST_SUBBITS) - 1;
+    uint64_t base = (uint64_t)(1u << HIST_SUBBITS) << shift;
+    uint64_t off = (uint64_t)(idx & ((1u << HIST_SUBBITS) - 1)) << shift;
+    return base + off + ((uint64_t)1 << shift) / 2;
+}
+
+static uint64_t hist_percentile(const struct hist *h, double pct) {
+    uint64_t target = (uint64_t)((double)h->total * pct / 100.0);
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen > target) return hist_bucket_value(i);
+    }
+    return 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+struct bench_cfg {
+    const char *host;
+    int port;
+    int conns;
+    int msgs;    /* per connection */
+    int size;    /* message size incl. trailing newline */
+    int depth;   /* requests in flight per connection */
+    int warmup;  /* unrecorded messages per connection before measuring */
+    int udp;     /* datagrams instead of a byte stream */
+};
+
+struct bench_worker {
+    pthread_t tid;
+    const struct bench_cfg *cfg;
+    int fd; /* pooled connection, established before the threads start */
+    struct hist h;
+    int failed;
+};
+
+static int recv_exact(int fd, char *buf, size_t need) {
+    size_t got = 0;
+    while (got < need) {
+        ssize_t n = recv_some(fd, buf, need - got);
+        if (n <= 0) return -1;
+        got += (size_t)n;
+    }
+    return 0;
+}
+
+/* Pipelined request/reply exchange of count messages on one pooled
+ * connection; latencies land in h unless it is NULL (warm-up rounds). */
+static int bench_stream(int fd, const struct bench_cfg *cfg, const char *msg,
+                        char *reply, uint64_t *sent_at, int count,
+                        struct hist *h) {
+    size_t replylen = sizeof(bench_reply_header) - 1 + (size_t)cfg->size;
+
+    /* Replies come back in order, so send timestamps only need a ring
+     * as deep as the pipeline window. */
+    int sent = 0, recvd = 0;
+    while (recvd < count) {
+        while (sent < count && sent - recvd < cfg->depth) {
+            sent_at[sent % cfg->depth] = now_ns();
+            if (send_all(fd, msg, (size_t)cfg->size) < 0) return -1;
+            sent++;
+        }
+
+        if (recv_exact(fd, reply, replylen) < 0) return -1;
+        if (h != NULL) hist_record(h, now_ns() - sent_at[recvd % cfg->depth]);
+        recvd++;
+    }
+    return 0;
+}
+
+static void *bench_worker_run(void *arg) {
+    struct bench_worker *w = arg;
+    const struct bench_cfg *cfg = w->cfg;
+    int fd = w->fd;
+
+    size_t replylen = sizeof(bench_reply_header) - 1 + (size_t)cfg->size;
+    char *msg = malloc((size_t)cfg->size);
+    char *reply = malloc(replylen);
+    uint64_t *sent_at = malloc((size_t)cfg->depth * sizeof(*sent_at));
+    if (msg == NULL || reply == NULL || sent_at == NULL) {
+        w->failed = 1;
+        goto out;
+    }
+
+    memset(msg, 'x', (size_t)cfg->size);
+    msg[cfg->size - 1] = '\n';
+
+    if (cfg->warmup > 0 &&
+        bench_stream(fd, cfg, msg, reply, sent_at, cfg->warmup, NULL) < 0) {
+        w->failed = 1;
+        goto out;
+    }
+    if (bench_stream(fd, cfg, msg, reply, sent_at, cfg->msgs, &w->h) < 0) {
+        w->failed = 1;
+        goto out;
+    }
+
+    send_all(fd, "quit\n", 5);
+
+out:
+    close(fd);
+    free(msg);
+    free(reply);
+    free(sent_at);
+    return NULL;
+}
+
+
+/*
+ * UDP variant of the benchmark worker: one datagram per message, sent in
+ * batches of up to a pipeline window per sendmmsg() call and collected
+ * the same way with recvmmsg(), so the syscall count scales with batches
+ * rather than packets. The socket is connect()ed, which both pins the
+ * peer (no per-packet address setup) and lets the kernel hand back ICMP
+ * errors. Timestamps are taken once per batch; within a batch the
+ * packets leave in one syscall anyway. A one second receive timeout
+ * turns dropped replies into a loss count instead of a hang.
+ */
+#define UDP_BENCH_BATCH 64
+
+/* One batched send/receive pass of count datagrams; latencies land in h
+ * unless it is NULL (warm-up rounds). Returns replies lost, or -1. */
+static int udp_rounds(int fd, const struct bench_cfg *cfg, const char *msg,
+                      char *rbuf, int count, struct hist *h) {
+    int batch = cfg->depth < UDP_BENCH_BATCH ? cfg->depth : UDP_BENCH_BATCH;
+    if (batch > count) batch = count;
+
+    size_t replylen = sizeof(bench_reply_header) - 1 + (size_t)cfg->size;
+    struct mmsghdr smsgs[UDP_BENCH_BATCH], rmsgs[UDP_BENCH_BATCH];
+    struct iovec siov[UDP_BENCH_BATCH], riov[UDP_BENCH_BATCH];
+
+    int done = 0, lost = 0;
+    while (done + lost < count) {
+        int k = count - done - lost;
+        if (k > batch) k = batch;
+
+        for (int i = 0; i < k; i++) {
+            siov[i].iov_base = (void *)msg;
+            siov[i].iov_len = (size_t)cfg->size;
+            memset(&smsgs[i].msg_hdr, 0, sizeof(smsgs[i].msg_hdr));
+            smsgs[i].msg_hdr.msg_iov = &siov[i];
+            smsgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        uint64_t t0 = now_ns();
+        int off = 0;
+        while (off < k) {
+            int s = sendmmsg(fd, smsgs + off, (unsigned)(k - off), 0);
+            if (s < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            off += s;
+        }
+
+        int got = 0;
+        while (got < k) {
+            for (int i = 0; i < k - got; i++) {
+                riov[i].iov_base = rbuf + (size_t)i * replylen;
+                riov[i].iov_len = replylen;
+                memset(&rmsgs[i].msg_hdr, 0, sizeof(rmsgs[i].msg_hdr));
+                rmsgs[i].msg_hdr.msg_iov = &riov[i];
+                rmsgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int r = recvmmsg(fd, rmsgs, (unsigned)(k - got), 0, NULL);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    lost += k - got;
+                    break;
+                }
+                return -1;
+            }
+            uint64_t now = now_ns();
+            if (h != NULL) {
+                for (int i = 0; i < r; i++) hist_record(h, now - t0);
+            }
+            got += r;
+        }
+        done += got;
+    }
+    return lost;
+}
+
+static void *bench_worker_udp(void *arg) {
+    struct bench_worker *w = arg;
+    const struct bench_cfg *cfg = w->cfg;
+    int fd = w->fd;
+
+    int batch = cfg->depth < UDP_BENCH_BATCH ? cfg->depth : UDP_BENCH_BATCH;
+    size_t replylen = sizeof(bench_reply_header) - 1 + (size_t)cfg->size;
+    char *msg = malloc((size_t)cfg->size);
+    char *rbuf = malloc((size_t)batch * replylen);
+    if (msg == NULL || rbuf == NULL) {
+        w->failed = 1;
+        goto out;
+    }
+
+    memset(msg, 'x', (size_t)cfg->size);
+    msg[cfg->size - 1] = '\n';
+
+    struct timeval tv = {1, 0};
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+        w->failed = 1;
+        goto out;
+    }
+
+    if (cfg->warmup > 0 &&
+        udp_rounds(fd, cfg, msg, rbuf, cfg->warmup, NULL) < 0) {
+        w->failed = 1;
+        goto out;
+    }
+    int lost = udp_rounds(fd, cfg, msg, rbuf, cfg->msgs, &w->h);
+    if (lost < 0) {
+        w->failed = 1;
+    } else if (lost > 0) {
+        fprintf(stderr, "udp: %d of %d replies lost\n", lost, cfg->msgs);
+    }
+
+out:
+    close(fd);
+    free(msg);
+    free(rbuf);
+    return NULL;
+}
+
+static void bench_report(const struct bench_cfg *cfg, const struct hist *total,
+                         uint64_t elapsed, int failures) {
+    double secs = (double)elapsed / 1e9;
+    double msgs = (double)total->total;
+    printf("elapsed:    %.3f s\n", secs);
+    printf("throughput: %.0f msg/s, %.2f MB/s echoed\n",
+           msgs / secs, msgs * (double)cfg->size / secs / 1e6);
+    printf("latency:    p50 %.1f us, p95 %.1f us, p99 %.1f us, p999 %.1f us\n",
+           (double)hist_percentile(total, 50) / 1e3,
+           (double)hist_percentile(total, 95) / 1e3,
+           (double)hist_percentile(total, 99) / 1e3,
+           (double)hist_percentile(total, 99.9) / 1e3);
+    if (failures > 0) {
+        printf("failures:   %d of %d connections aborted early\n", failures, cfg->conns);
+    }
+}
+
+/* How many connects to fire before pausing the ramp briefly; keeps a
+ * big -c from overflowing the server's listen backlog in one burst. */
+#define POOL_RAMP_BATCH 64
+
+static int run_bench(const struct bench_cfg *cfg) {
+    struct bench_worker *workers = calloc((size_t)cfg->conns, sizeof(*workers));
+    if (workers == NULL) die("ERROR allocating benchmark workers");
+
+    printf("bench: %d conns x %d msgs of %d bytes, depth %d%s%s\n",
+           cfg->conns, cfg->msgs, cfg->size, cfg->depth,
+           cfg->udp ? " (udp)" : "",
+           cfg->warmup > 0 ? " (warmed)" : "");
+
+    /* Establish the whole pool before any traffic, so the measured phase
+     * exercises the echo path and never the TCP setup path. */
+    struct hist connect_h;
+    memset(&connect_h, 0, sizeof(connect_h));
+    uint64_t pool_start = now_ns();
+    for (int i = 0; i < cfg->conns; i++) {
+        workers[i].cfg = cfg;
+        uint64_t t0 = now_ns();
+        workers[i].fd = connect_to(cfg->host, cfg->port, cfg->udp);
+        hist_record(&connect_h, now_ns() - t0);
+        if ((i + 1) % POOL_RAMP_BATCH == 0) usleep(2000);
+    }
+    uint64_t pool_elapsed = now_ns() - pool_start;
+    printf("connect:    %d conns in %.1f ms, p50 %.1f us, p99 %.1f us\n",
+           cfg->conns, (double)pool_elapsed / 1e6,
+           (double)hist_percentile(&connect_h, 50) / 1e3,
+           (double)hist_percentile(&connect_h, 99) / 1e3);
+
+    void *(*worker)(void *) = cfg->udp ? bench_worker_udp : bench_worker_run;
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < cfg->conns; i++) {
+        if (pthread_create(&workers[i].tid, NULL, worker, &workers[i]) != 0) {
+            die("ERROR creating benchmark thread");
+        }
+    }
+
+    struct hist total;
+    memset(&total, 0, sizeof(total));
+    int failures = 0;
+    for (int i = 0; i < cfg->conns; i++) {
+        pthread_join(workers[i].tid, NULL);
+        hist_merge(&total, &workers[i].h);
+        failures += workers[i].failed;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    bench_report(cfg, &total, elapsed, failures);
+
+    free(workers);
+    return failures > 0 ? 1 : 0;
+}
+
+/* ---- epoll-driven engine (-E) ---- */
+
+/*
+ * Nonblocking counterpart of the thread workers: every connection runs
+ * under one epoll loop, each keeping up to depth requests pipelined.
+ * A connection is a small state machine: RUN while echo traffic is in
+ * flight, QUIT once the last reply landed and the quit line is going
+ * out, BYE while draining the server's goodbye until EOF.
+ */
+
+enum engine_state {
+    ENG_RUN,
+    ENG_QUIT,
+    ENG_BYE
+};
+
+struct engine_conn {
+    int fd;                 /* -1 once closed */
+    int state;
+    int sent, recvd;        /* messages fully sent / replies fully received */
+    size_t send_off;        /* bytes of the in-progress message already out */
+    size_t recv_off;        /* bytes received toward the next reply boundary */
+    size_t quit_off;
+    uint64_t *sent_at;      /* ring of send timestamps, depth entries */
+    int want_write;         /* EPOLLOUT currently subscribed */
+};
+
+/*
+ * Drain readable bytes. Replies are a fixed-size byte stream, so byte
+ * counting finds message boundaries no matter how reads are split.
+ * Returns 1 when the connection finished cleanly (EOF after the quit
+ * handshake), 0 to continue, -1 on error or premature EOF.
+ */
+static int engine_readable(struct engine_conn *c, const struct bench_cfg *cfg,
+                           struct hist *h, char *scratch, size_t scratch_cap,
+                           size_t replylen) {
+    while (1) {
+        ssize_t n = read(c->fd, scratch, scratch_cap);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        if (n == 0) {
+            return (c->state == ENG_BYE) ? 1 : -1;
+        }
+        if (c->state != ENG_RUN) continue; /* goodbye bytes, not timed */
+
+        c->recv_off += (size_t)n;
+        while (c->recv_off >= replylen && c->recvd < cfg->msgs) {
+            c->recv_off -= replylen;
+            hist_record(h, now_ns() - c->sent_at[c->recvd % cfg->depth]);
+            c->recvd++;
+        }
+        if (c->recvd == cfg->msgs) c->state = ENG_QUIT;
+    }
+}
+
+/*
+ * Push bytes until the socket would block or there is nothing to send
+ * (pipeline window full, all messages out, or BYE state). Returns 1 if
+ * EPOLLOUT is still needed, 0 if not, -1 on error.
+ */
+static int engine_writable(struct engine_conn *c, const struct bench_cfg *cfg,
+                           const char *msg) {
+    while (1) {
+        if (c->state == ENG_RUN) {
+            if (c->send_off == 0) {
+                if (c->sent >= cfg->msgs || c->sent - c->recvd >= cfg->depth) {
+                    return 0;
+                }
+                c->sent_at[c->sent % cfg->depth] = now_ns();
+            }
+            ssize_t n = write(c->fd, msg + c->send_off,
+                              (size_t)cfg->size - c->send_off);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+                return -1;
+            }
+            c->send_off += (size_t)n;
+            if (c->send_off == (size_t)cfg->size) {
+                c->send_off = 0;
+                c->sent++;
+            }
+        } else if (c->state == ENG_QUIT) {
+            ssize_t n = write(c->fd, "quit\n" + c->quit_off, 5 - c->quit_off);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+                return -1;
+            }
+            c->quit_off += (size_t)n;
+            if (c->quit_off == 5) c->state = ENG_BYE;
+        } else {
+            return 0;
+        }
+    }
+}
+
+#define ENGINE_SCRATCH (64 * 1024)
+#define ENGINE_MAX_EVENTS 64
+
+static int run_bench_engine(const struct bench_cfg *cfg) {
+    size_t replylen = sizeof(bench_reply_header) - 1 + (size_t)cfg->size;
+    struct engine_conn *conns = calloc((size_t)cfg->conns, sizeof(*conns));
+    char *msg = malloc((size_t)cfg->size);
+    char *scratch = malloc(ENGINE_SCRATCH);
+    if (conns == NULL || msg == NULL || scratch == NULL) {
+        die("ERROR allocating engine state");
+    }
+    memset(msg, 'x', (size_t)cfg->size);
+    msg[cfg->size - 1] = '\n';
+
+    printf("bench: %d conns x %d msgs of %d bytes, depth %d (epoll engine)\n",
+           cfg->conns, cfg->msgs, cfg->size, cfg->depth);
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) die("ERROR epoll_create1");
+
+    struct hist total;
+    memset(&total, 0, sizeof(total));
+
+    uint64_t start = now_ns();
+
+    for (int i = 0; i < cfg->conns; i++) {
+        struct engine_conn *c = &conns[i];
+        c->fd = connect_to(cfg->host, cfg->port, 0);
+        c->sent_at = malloc((size_t)cfg->depth * sizeof(*c->sent_at));
+        if (c->sent_at == NULL) die("ERROR allocating timestamp ring");
+
+        int flags = fcntl(c->fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(c->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            die("ERROR setting socket nonblocking");
+        }
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t)i;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+            die("ERROR epoll_ctl(add)");
+        }
+    }
+
+    /* Prime the pipelines: fresh sockets have empty send buffers, so the
+     * first window usually goes out before the first epoll_wait. */
+    int open_conns = cfg->conns;
+    int failures = 0;
+    for (int i = 0; i < cfg->conns; i++) {
+        struct engine_conn *c = &conns[i];
+        int w = engine_writable(c, cfg, msg);
+        if (w < 0) {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+            close(c->fd);
+            c->fd = -1;
+            open_conns--;
+            failures++;
+        } else if (w != c->want_write) {
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | (w ? EPOLLOUT : 0);
+            ev.data.u32 = (uint32_t)i;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+            c->want_write = w;
+        }
+    }
+
+    struct epoll_event events[ENGINE_MAX_EVENTS];
+    while (open_conns > 0) {
+        int nready = epoll_wait(epfd, events, ENGINE_MAX_EVENTS, -1);
+        if (nready < 0) {
+            if (errno == EINTR) continue;
+            die("ERROR epoll_wait");
+        }
+
+        for (int e = 0; e < nready; e++) {
+            uint32_t i = events[e].data.u32;
+            struct engine_conn *c = &conns[i];
+            if (c->fd < 0) continue;
+
+            int err = 0, done = 0;
+            if (events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                int r = engine_readable(c, cfg, &total, scratch,
+                                        ENGINE_SCRATCH, replylen);
+                if (r < 0) err = 1;
+                if (r > 0) done = 1;
+            }
+            if (!err && !done) {
+                /* A reply may have opened the window or triggered the
+                 * quit line; always try to write before sleeping. */
+                int w = engine_writable(c, cfg, msg);
+                if (w < 0) {
+                    err = 1;
+                } else if (w != c->want_write) {
+                    struct epoll_event ev;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = EPOLLIN | (w ? EPOLLOUT : 0);
+                    ev.data.u32 = i;
+                    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+                    c->want_write = w;
+                }
+            }
+
+            if (err || done) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+                close(c->fd);
+                c->fd = -1;
+                open_conns--;
+                failures += err;
+            }
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    bench_report(cfg, &total, elapsed, failures);
+
+    close(epfd);
+    for (int i = 0; i < cfg->conns; i++) free(conns[i].sent_at);
+    free(conns);
+    free(msg);
+    free(scratch);
+    return failures > 0 ? 1 : 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-U] hostname port  (or: %s socket-path)\n", prog, prog);
+    fprintf(stderr, "       %s -B [-E|-U] [-c conns] [-n msgs] [-s size] [-p depth] [-W warmup] hostname port\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int sockfd;
+    int portno;
+
+    char buffer[256];
+    char reply[256];
+
+    /* A server that closes mid-stream should fail the affected worker's
+     * write, not kill the whole benchmark. */
+    signal(SIGPIPE, SIG_IGN);
+
+    int bench = 0;
+    int engine = 0;
+    struct bench_cfg cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.conns = 1;
+    cfg.msgs = 10000;
+    cfg.size = 64;
+    cfg.depth = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "BEUc:n:s:p:W:")) != -1) {
+        switch (opt) {
+        case 'B':
+            bench = 1;
+            break;
+        case 'E':
+            engine = 1;
+            break;
+        case 'U':
+            cfg.udp = 1;
+            break;
+        case 'c':
+            cfg.conns = atoi(optarg);
+            if (cfg.conns <= 0) usage(argv[0]);
+            break;
+        case 'n':
+            cfg.msgs = atoi(optarg);
+            if (cfg.msgs <= 0) usage(argv[0]);
+            break;
+        case 's':
+            cfg.size = atoi(optarg);
+            if (cfg.size < 2) usage(argv[0]); /* payload + trailing newline */
+            break;
+        case 'p':
+            cfg.depth = atoi(optarg);
+            if (cfg.depth <= 0) usage(argv[0]);
+            break;
+        case 'W':
+            cfg.warmup = atoi(optarg);
+            if (cfg.warmup < 0) usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc) usage(argv[0]);
+
+    /* One positional argument: an AF_UNIX socket path. Two: host, port. */
+    if (optind + 1 == argc) {
+        if (cfg.udp) {
+            fprintf(stderr, "-U is TCP/UDP only; unix sockets use a stream\n");
+            usage(argv[0]);
+        }
+        portno = -1;
+    } else {
+        portno = atoi(argv[optind + 1]);
+    }
+
+    if (bench) {
+        cfg.host = argv[optind];
+        cfg.port = portno;
+        if (engine && cfg.udp) {
+            fprintf(stderr, "-E drives TCP streams; use -U without it\n");
+            usage(argv[0]);
+        }
+        if (engine && cfg.warmup > 0) {
+            fprintf(stderr, "note: -E has no warm-up phase; ignoring -W\n");
+        }
+        return engine ? run_bench_engine(&cfg) : run_bench(&cfg);
+    }
+
+    sockfd = connect_to(argv[optind], portno, cfg.udp);
+
     printf("Connected. Type messages; 'quit' or 'exit' to close.\n");
 
     while (1) {
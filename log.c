@@ -0,0 +1,130 @@
+/*
+ * Lock-free ring-buffer logger (see log.h).
+ *
+ * The ring is a bounded multi-producer queue in the style of Vyukov's
+ * MPMC queue: each slot carries a sequence number so producers claim
+ * slots with one fetch_add and publish them with one store, and the
+ * single consumer (the drain thread) never takes a lock.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define LOG_RING_SIZE 4096 /* power of two */
+#define LOG_LINE_MAX 256
+
+struct log_slot {
+    atomic_size_t seq;
+    unsigned short len;
+    char line[LOG_LINE_MAX];
+};
+
+static struct log_slot ring[LOG_RING_SIZE];
+static atomic_size_t head; /* next slot to claim (producers) */
+static size_t tail;        /* next slot to drain (consumer only) */
+static atomic_ulong dropped;
+
+static int level = LOG_MSG;
+static int running = 0;
+static pthread_t drain_thread;
+
+void log_set_level(int lvl) {
+    level = lvl;
+}
+
+int log_enabled(int lvl) {
+    return lvl <= level;
+}
+
+static void *drain_loop(void *arg) {
+    (void)arg;
+
+    while (1) {
+        struct log_slot *slot = &ring[tail & (LOG_RING_SIZE - 1)];
+
+        /* A slot is ready once its sequence is one past the claim value. */
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != tail + 1) {
+            unsigned long d = atomic_exchange(&dropped, 0);
+            if (d > 0) {
+                fprintf(stdout, "[logger] dropped %lu lines\n", d);
+            }
+            fflush(stdout);
+            usleep(1000);
+            continue;
+        }
+
+        fwrite(slot->line, 1, slot->len, stdout);
+        atomic_store_explicit(&slot->seq, tail + LOG_RING_SIZE, memory_order_release);
+        tail++;
+    }
+
+    return NULL;
+}
+
+void log_init(void) {
+    if (running) return;
+
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_store_explicit(&ring[i].seq, i, memory_order_relaxed);
+    }
+    atomic_store(&head, 0);
+    tail = 0;
+
+    if (pthread_create(&drain_thread, NULL, drain_loop, NULL) == 0) {
+        running = 1;
+    } else {
+        perror("ERROR starting logger thread");
+    }
+}
+
+void log_write(int lvl, const char *fmt, ...) {
+    if (lvl > level) return;
+
+    char line[LOG_LINE_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n >= sizeof(line)) n = sizeof(line) - 1;
+
+    if (!running) {
+        /* synchronous fallback: same visible behavior as plain printf */
+        fwrite(line, 1, (size_t)n, stdout);
+        fflush(stdout);
+        return;
+    }
+
+    size_t pos = atomic_load_explicit(&head, memory_order_relaxed);
+    while (1) {
+        struct log_slot *slot = &ring[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+        if (seq == pos) {
+            /* Slot is free; try to claim it. On CAS failure pos is
+             * reloaded and we retry. */
+            if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                memcpy(slot->line, line, (size_t)n);
+                slot->len = (unsigned short)n;
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                return;
+            }
+        } else if ((ptrdiff_t)(seq - pos) < 0) {
+            /* Consumer has not recycled this slot: ring is full. Drop
+             * rather than block the hot path. */
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&head, memory_order_relaxed);
+        }
+    }
+}
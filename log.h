@@ -0,0 +1,35 @@
+/*
+ * Asynchronous logging for the server hot path.
+ *
+ * Producers format a line into a slot of a lock-free ring buffer; a
+ * dedicated logger thread drains the ring to stdout. The connection
+ * handlers therefore never block on stdout flushing. If the ring is
+ * full the line is dropped and counted rather than stalling a worker.
+ *
+ * Before log_init() is called (or in short-lived forked children that
+ * choose not to start a drain thread) log_write() falls back to a
+ * synchronous printf+fflush, preserving the old behavior.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+enum log_level {
+    LOG_QUIET = 0, /* nothing per connection or message */
+    LOG_CONN = 1,  /* connect/disconnect events */
+    LOG_MSG = 2    /* every message (the old default) */
+};
+
+/* Start the drain thread for the calling process. Call once per process
+ * that logs; forked children must call it themselves if they want the
+ * async path. */
+void log_init(void);
+
+void log_set_level(int level);
+int log_enabled(int level);
+
+/* Format and enqueue one line. No-op above the current level. */
+void log_write(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#endif /* LOG_H */
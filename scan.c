@@ -0,0 +1,80 @@
+/*
+ * Runtime-dispatched byte scanning (see scan.h).
+ *
+ * The x86 variants are compiled with per-function target attributes so
+ * one binary carries all of them; scan_init() binds the best one the
+ * machine actually supports.
+ */
+
+#include <string.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_HAVE_X86 1
+#endif
+
+static const char *find_byte_scalar(const char *buf, size_t len, char c) {
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == c) return buf + i;
+    }
+    return NULL;
+}
+
+#ifdef SCAN_HAVE_X86
+
+__attribute__((target("sse2")))
+static const char *find_byte_sse2(const char *buf, size_t len, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(buf + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask != 0) return buf + i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+
+    return find_byte_scalar(buf + i, len - i, c);
+}
+
+__attribute__((target("avx2")))
+static const char *find_byte_avx2(const char *buf, size_t len, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(buf + i));
+        int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if (mask != 0) return buf + i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+
+    return find_byte_scalar(buf + i, len - i, c);
+}
+
+#endif /* SCAN_HAVE_X86 */
+
+static const char *(*find_byte_impl)(const char *, size_t, char) = find_byte_scalar;
+
+void scan_init(void) {
+#ifdef SCAN_HAVE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        find_byte_impl = find_byte_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        find_byte_impl = find_byte_sse2;
+    }
+#endif
+}
+
+const char *scan_find_byte(const char *buf, size_t len, char c) {
+    return find_byte_impl(buf, len, c);
+}
+
+int scan_prefix_ci(const char *s, size_t n, const char *prefix) {
+    /* ASCII letters differ from their lowercase form only in bit 5, so
+     * OR-ing 0x20 folds case without a table or branch per byte. */
+    for (size_t i = 0; i < n; i++) {
+        if ((char)(s[i] | 0x20) != prefix[i]) return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,28 @@
+/*
+ * Vectorized buffer scanning for the message hot path.
+ *
+ * scan_find_byte() is the delimiter search used by the frame parser;
+ * the implementation is chosen once at startup via cpuid (AVX2, then
+ * SSE2, then a scalar loop), so the per-message cost on a capable
+ * machine is a handful of wide compares instead of a byte loop.
+ * scan_prefix_ci() is the case-insensitive command match; command words
+ * are a few bytes, so it stays scalar but branch-light.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/* Select the widest implementation the CPU supports. Safe to skip: the
+ * scalar fallback is the initial binding. */
+void scan_init(void);
+
+/* First occurrence of c in buf[0..len), or NULL. */
+const char *scan_find_byte(const char *buf, size_t len, char c);
+
+/* 1 if s[0..n) equals the all-lowercase prefix ignoring ASCII case.
+ * prefix must be lowercase letters only. */
+int scan_prefix_ci(const char *s, size_t n, const char *prefix);
+
+#endif /* SCAN_H */
@@ -1,28 +1,199 @@
 /*
- * Concurrent TCP server (fork-per-connection) with per-connection read/write loop
+ * Concurrent TCP server with per-connection read/write loop
  *
- * Build: gcc -Wall -Wextra -O2 server_fork_loop.c -o server
- * Run:   ./server <port>
+ * Build: make  (or: gcc -Wall -Wextra -O2 -pthread server.c log.c arena.c scan.c stats.c -o server)
+ * Run:   ./server [-m fork|epoll|prefork|thread|uring|udp] [-w workers]
+ *                 [-b bufsize]
+ *                 [-l loglevel] [-t idle-timeout] [-z] [-a] [-r] [--backlog n]
+ *                 [--nodelay] [--quickack] [--keepalive] [--sockbuf bytes]
+ *                 <port | /socket-path>
  *
  * Behavior:
  * - Accepts connections forever (while(1))
- * - Each connection is handled in a child process (fork)
- * - Child reads multiple messages until client closes or sends "quit"/"exit"
+ * - In "fork" mode (default) each connection is handled in a child process
+ * - In "epoll" mode all connections are driven from a single event loop
+ *   with nonblocking sockets, so one process can hold very large numbers
+ *   of idle connections without per-connection fork cost
+ * - In "prefork" mode N workers (default: one per core) are forked at
+ *   startup; each binds its own SO_REUSEPORT listening socket and runs
+ *   the epoll loop, so the kernel shards accepts across workers
+ * - In "thread" mode a fixed pool of threads (default: one per core) runs
+ *   handle_client_loop(); the acceptor pushes fds onto per-thread queues,
+ *   so all connections share one address space with no fork cost
+ * - A connection is served until the client closes or sends "quit"/"exit"
+ * - Event-loop connections are edge-triggered and drain reads to EAGAIN;
+ *   their receive buffers start at 4KB and double up to -b bytes while a
+ *   connection keeps filling them, shrinking back (releasing the arena)
+ *   after a sustained run of quiet events, so large mostly-idle
+ *   connection counts stay cheap in memory while busy connections avoid
+ *   a syscall per few hundred bytes
+ * - In the epoll-based modes replies that would block are parked in a
+ *   per-connection send queue and drained on EPOLLOUT, so one slow
+ *   receiver never stalls or errors the other connections on its
+ *   worker. Reads pause only above a high watermark and resume below a
+ *   low one, and when all queues together cross a global cap the
+ *   connections with the largest backlogs are shed, so memory stays
+ *   bounded even against adversarial peers
+ * - Event-loop connections can act as a lightweight pub/sub hub: "sub"
+ *   subscribes a connection, "pub <text>" fans the text out to every
+ *   subscriber on the worker. The payload is copied once into a
+ *   reference-counted buffer and stitched behind a per-delivery header
+ *   with writev, so 1-to-N fan-out costs one copy, not N; slow
+ *   subscribers fall back to the watermarked send queue
+ * - An optional binary protocol is negotiated on the first four bytes of
+ *   a connection ("EB01"): fixed 8-byte type+length headers carrying
+ *   ECHO/PING/QUIT/STATS requests, replies precomputed where they never
+ *   vary, so machine peers skip text parsing entirely while existing
+ *   text clients keep working unchanged
+ * - In "uring" mode I/O runs on io_uring (raw syscalls, no liburing):
+ *   multishot accept plus batched recv/send submissions, so idle-cycle
+ *   syscall overhead collapses to one io_uring_enter per loop iteration
+ * - With -a, prefork and thread workers are pinned round-robin to cores
+ *   with sched_setaffinity. Because each worker maps and first-touches
+ *   its own connection arenas after pinning, the kernel's first-touch
+ *   policy places those pages on the worker's NUMA node; prefork workers
+ *   additionally set SO_INCOMING_CPU on their listener so connections
+ *   whose packets arrive on a worker's core are steered to that worker's
+ *   SO_REUSEPORT socket, keeping interrupts, worker, and buffers on one
+ *   node
+ * - Fast restart: with -r the listener binds with SO_REUSEPORT, so a
+ *   replacement instance (also started with -r) can bind the same port
+ *   while the old one still serves. SIGTERM then drains the old
+ *   instance: it stops accepting (uring mode cancels its multishot
+ *   accept) and exits once the last in-flight connection finishes, so a
+ *   deploy drops nothing
+ * - A positional argument with any non-digit in it is taken as an
+ *   AF_UNIX socket path instead of a TCP port: same protocol, same
+ *   modes (except prefork/udp/-r, which lean on SO_REUSEPORT or UDP),
+ *   without loopback's checksum and netfilter overhead for colocated
+ *   producers
+ * - In "udp" mode datagrams are served without connections: recvmmsg()
+ *   pulls up to 64 packets per syscall and sendmmsg() pushes the replies
+ *   back in one more, each datagram handled like one text message
+ *   (quit/exit answers "Bye.", everything else is acked and echoed)
+ * - Socket tuning: --backlog sets the listen queue depth (default 1024;
+ *   the old hardcoded 5 dropped SYNs under bursts), --nodelay disables
+ *   Nagle on accepted sockets, --quickack disables delayed ACKs,
+ *   --keepalive enables TCP keepalive, --sockbuf sets SO_RCVBUF and
+ *   SO_SNDBUF on accepted sockets
+ * - With -t seconds, epoll-based modes reap idle connections through a
+ *   hashed timer wheel: insert and expiry are O(1) per connection, so
+ *   expiring very large idle populations costs almost nothing. Reaped
+ *   connections get the same "Bye." close as a quit command
+ * - Aggregate counters (connections, messages, bytes) live in a shared
+ *   mmap region with one cache-line-padded slot per worker; SIGUSR1
+ *   prints a snapshot without touching the hot path
+ * - Per-connection and per-message logging goes through the async ring
+ *   buffer in log.c; -l selects the level (0 quiet, 1 connections,
+ *   2 every message, the default)
+ * - With -z (fork and thread modes) connections are echoed zero-copy with
+ *   splice() through a pipe: payload bytes never enter userspace, so bulk
+ *   transfers are not limited by per-read copies. No command parsing in
+ *   this mode; the connection ends when the client closes it
  */
 
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+/*
+ * Compile-time protocol specialization (-DPROTO_VARIANT=n; see the
+ * server-text/server-binary/server-hub make targets). 0, the default,
+ * keeps runtime dispatch between all protocols for development; 1 is
+ * text echo only, 2 binary only, 3 text plus the broadcast hub.
+ * Single-variant builds fold the per-message dispatch branch away and
+ * drop the unused parsers from the binary, keeping the hot loop
+ * monomorphic.
+ */
+#ifndef PROTO_VARIANT
+#define PROTO_VARIANT 0
+#endif
+#define PROTO_HAS_TEXT (PROTO_VARIANT != 2)
+#define PROTO_HAS_BIN (PROTO_VARIANT == 0 || PROTO_VARIANT == 2)
+#define PROTO_HAS_HUB (PROTO_VARIANT == 0 || PROTO_VARIANT == 3)
+
+#include "arena.h"
+#include "log.h"
+#include "scan.h"
+#include "stats.h"
+#include "trace.h"
+
+enum server_mode {
+    MODE_FORK,
+    MODE_EPOLL,
+    MODE_PREFORK,
+    MODE_THREAD,
+    MODE_URING,
+    MODE_UDP
+};
+
+/* -z: echo with splice() instead of the read/reply protocol */
+static int zero_copy_echo = 0;
+
+/* -b: per-connection receive buffer size; large enough that bulk messages
+ * do not cost a syscall per few hundred bytes */
+static size_t conn_bufsize = 64 * 1024;
+
+/* -t: seconds a connection may stay idle before the reaper closes it
+ * (0 disables reaping) */
+static int idle_timeout = 0;
+
+/* -a: pin prefork/thread workers round-robin to cores */
+static int pin_workers = 0;
+
+/* -r: bind the listener with SO_REUSEPORT so a replacement instance can
+ * bind the same port while this one is still serving */
+static int reuse_listener = 0;
+
+/* When serving AF_UNIX, the bound socket path; NULL means TCP. */
+static const char *unix_path = NULL;
+
+/* Set by SIGTERM: stop accepting, serve out what is open, then exit */
+static volatile sig_atomic_t draining = 0;
+
+/* Connections currently open in this process; thread mode shares it
+ * between acceptor and workers, the other modes are single-threaded */
+static _Atomic long live_conns = 0;
+
+static const char reply_header[] = "I got your message\n";
+static const char reply_bye[] = "Bye.\n";
+
+/* Socket tuning knobs (--backlog/--nodelay/--quickack/--keepalive/--sockbuf).
+ * Backlog applies to the listen socket; the rest to accepted sockets. */
+static struct {
+    int backlog;
+    int nodelay;
+    int quickack;
+    int keepalive;
+    int sockbuf;
+} tuning = { 1024, 0, 0, 0, 0 };
+
 static void die(const char *msg) {
     perror(msg);
     exit(1);
@@ -35,140 +206,2528 @@ static void reap_children(int signo) {
     }
 }
 
+static void handle_drain(int signo) {
+    (void)signo;
+    draining = 1;
+}
+
 static int is_quit_cmd(const char *s) {
     /* Treat lines starting with "quit" or "exit" (case-insensitive, ignoring leading spaces) as termination */
     while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') s++;
     if (*s == '\0') return 0;
 
-    char tmp[8];
-    size_t i = 0;
-    while (i < sizeof(tmp) - 1 && s[i] && s[i] != ' ' && s[i] != '\t' && s[i] != '\r' && s[i] != '\n') {
-        tmp[i] = (char)tolower((unsigned char)s[i]);
-        i++;
+    size_t wordlen = 0;
+    while (s[wordlen] && s[wordlen] != ' ' && s[wordlen] != '\t' &&
+           s[wordlen] != '\r' && s[wordlen] != '\n') {
+        wordlen++;
+    }
+    if (wordlen != 4) return 0;
+    return scan_prefix_ci(s, 4, "quit") || scan_prefix_ci(s, 4, "exit");
+}
+
+#if PROTO_HAS_HUB
+/* "sub" on a line of its own subscribes the connection to broadcasts. */
+static int is_sub_cmd(const char *s) {
+    while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') s++;
+    size_t wordlen = 0;
+    while (s[wordlen] != '\0' && s[wordlen] != ' ' && s[wordlen] != '\t' &&
+           s[wordlen] != '\r' && s[wordlen] != '\n') {
+        wordlen++;
+    }
+    if (wordlen != 3) return 0;
+    return scan_prefix_ci(s, 3, "sub");
+}
+
+/* "pub <text>" publishes <text> (newline included) to all subscribers;
+ * returns the payload within [s, end) or NULL if this is not a publish. */
+static const char *pub_payload(const char *s, const char *end, size_t *plen) {
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+    if (end - s < 3 || !scan_prefix_ci(s, 3, "pub")) return NULL;
+    s += 3;
+    if (s < end && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n') {
+        return NULL; /* "pubx..." is ordinary data */
+    }
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+    *plen = (size_t)(end - s);
+    return s;
+}
+#endif /* PROTO_HAS_HUB */
+
+/* Format "ip:port" once per connection into the caller's cache (the conn
+ * slot or a stack buffer), so the per-message path only ever references
+ * a ready string. inet_ntop renders into local storage, unlike
+ * inet_ntoa's process-wide static buffer, which two pool threads
+ * accepting at once would silently corrupt. */
+#define PEER_STR_MAX 32
+
+static void format_peer(const struct sockaddr_in *addr, char *out, size_t cap) {
+    /* Unix-domain peers are usually unnamed; there is nothing to print. */
+    if (addr->sin_family != AF_INET) {
+        snprintf(out, cap, "local");
+        return;
+    }
+    char ip[INET_ADDRSTRLEN];
+    if (inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip)) == NULL) {
+        snprintf(out, cap, "?");
+        return;
+    }
+    snprintf(out, cap, "%s:%u", ip, ntohs(addr->sin_port));
+}
+
+/* Write all iovecs, resuming after partial writes, so header + payload
+ * leave in a single syscall in the common case. Modifies iov in place. */
+static int send_iov(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        size_t left = (size_t)n;
+        while (iovcnt > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return 0;
+}
+
+/* ---- per-connection state and send queue ---- */
+
+struct bcast_buf;
+
+/*
+ * Per-connection state. Slots live in a preallocated slab indexed
+ * directly by fd (see conn_table_create), and the layout is deliberate:
+ * every field the event loop touches on every single event -- liveness,
+ * protocol, the buffer pointers and cursors -- is packed into the first
+ * 64 bytes, so the common read/parse/reply cycle warms exactly one cache
+ * line per connection. Cold fields (peer address, timer linkage, the
+ * arena handle) follow and are only reached at accept, timeout or close.
+ */
+struct conn {
+    /* hot: read on every event */
+    _Alignas(64) int active;
+    int proto;           /* enum conn_proto; settled by the first bytes */
+    int closing;         /* close once the send queue drains */
+    unsigned char quiet; /* consecutive low-volume events, drives shrink */
+    unsigned char paused; /* reads parked until the queue hits low water */
+    /* buffered input: partial frames survive across events. incap is the
+     * current (adaptive) capacity; it starts small and doubles up to
+     * conn_bufsize while the connection keeps filling it */
+    char *inbuf;
+    size_t inlen;
+    size_t incap;
+    /* queued output (epoll: EAGAIN overflow, uring: staged replies) */
+    char *outbuf;
+    size_t outlen;
+    size_t outoff;
+
+    /* cold: accept/timeout/close paths only */
+    /* all per-connection allocations come from here and die together */
+    struct arena *arena;
+    struct sockaddr_in addr;
+    char peer[PEER_STR_MAX]; /* "ip:port", formatted once at accept */
+    /* timer-wheel linkage (fd indices; -1 when not scheduled) */
+    int tw_next;
+    int tw_prev;
+    uint64_t deadline; /* CLOCK_MONOTONIC seconds */
+    /* broadcast: subscriber flag and an in-flight shared payload */
+    int sub;
+    struct bcast_buf *bc;
+    size_t bc_off; /* progress through header + payload */
+};
+
+_Static_assert(offsetof(struct conn, outoff) + sizeof(size_t) <= 64,
+               "hot connection fields must fit the first cache line");
+
+/* ---- broadcast fan-out ---- */
+
+#if PROTO_HAS_HUB
+/*
+ * Hub commands for event-loop connections: "sub" marks a connection as
+ * a subscriber, "pub <text>" fans the text out to every subscriber on
+ * the worker. The payload is parsed once and copied once, into a
+ * reference-counted buffer; every delivery stitches those shared bytes
+ * behind a per-delivery header with writev, so 1-to-N fan-out costs one
+ * copy total instead of N. Only a subscriber too slow to take the bytes
+ * synchronously holds a reference (finished from the writable handler);
+ * one that falls further behind degrades to a copy in its regular
+ * bounded send queue.
+ */
+static const char reply_subscribed[] = "Subscribed.\n";
+static const char reply_no_hub[] = "Broadcast needs an event-loop mode.\n";
+static const char bcast_header[] = "bcast: ";
+#define BCAST_HDR_LEN (sizeof(bcast_header) - 1)
+
+struct bcast_buf {
+    int refs;
+    size_t len;
+    char data[];
+};
+
+static struct bcast_buf *bcast_get(const char *payload, size_t len) {
+    struct bcast_buf *b = malloc(sizeof(*b) + len);
+    if (b == NULL) return NULL;
+    b->refs = 1;
+    b->len = len;
+    memcpy(b->data, payload, len); /* the one copy in the whole fan-out */
+    return b;
+}
+
+static void bcast_put(struct bcast_buf *b) {
+    if (--b->refs == 0) free(b);
+}
+
+/* Set by run_epoll_loop; NULL in modes without a shared connection
+ * table, where sub/pub answer an explanatory line instead. */
+static struct conn *bcast_conns;
+static int bcast_epfd;
+
+static size_t bcast_remaining(const struct conn *c) {
+    return c->bc != NULL ? BCAST_HDR_LEN + c->bc->len - c->bc_off : 0;
+}
+#else /* !PROTO_HAS_HUB */
+/* No hub in this variant: c->bc stays NULL and these fold to nothing. */
+static size_t bcast_remaining(const struct conn *c) {
+    (void)c;
+    return 0;
+}
+static void bcast_put(struct bcast_buf *b) {
+    (void)b;
+}
+#endif /* PROTO_HAS_HUB */
+
+/*
+ * Event-loop send queue: reply bytes a slow peer would have blocked on
+ * are parked in c->outbuf and drained on EPOLLOUT, so one closed receive
+ * window never stalls the other connections on the worker. Capacity
+ * covers the worst-case expansion of one full input buffer (1-byte
+ * lines: each 2 input bytes become header + echo, ~11x); the buffer is
+ * allocated from the arena only when a peer actually falls behind, so
+ * well-behaved connections never pay for it.
+ */
+#define OUT_QUEUE_CAP (conn_bufsize * 11)
+
+/*
+ * Flow-control watermarks. A connection keeps being read while its
+ * backlog stays under the high watermark; above it, EPOLLIN is dropped
+ * until the drain brings it back below the low one, so a single slow
+ * ack doesn't flap the event mask. Crossing the global cap -- all
+ * queues on the worker combined -- sheds the largest backlogs outright:
+ * bounded memory matters more than any one adversarial peer.
+ */
+#define OUT_HIGH_WATER (OUT_QUEUE_CAP / 2)
+#define OUT_LOW_WATER (OUT_QUEUE_CAP / 8)
+#define QUEUED_GLOBAL_MAX (OUT_QUEUE_CAP * 64)
+
+static size_t queued_total;   /* parked reply bytes across the worker */
+static size_t conn_table_size;
+
+static int queue_pending(const struct conn *c) {
+    return c != NULL && c->outlen > c->outoff;
+}
+
+static size_t conn_backlog(const struct conn *c) {
+    return c->outlen - c->outoff + bcast_remaining(c);
+}
+
+static int queue_append(struct conn *c, const struct iovec *iov, int iovcnt) {
+    size_t add = 0;
+    for (int i = 0; i < iovcnt; i++) add += iov[i].iov_len;
+    if (add == 0) return 0;
+
+    if (c->outbuf == NULL) {
+        c->outbuf = arena_alloc(c->arena, OUT_QUEUE_CAP);
+        if (c->outbuf == NULL) {
+            perror("ERROR allocating send queue");
+            return -1;
+        }
     }
-    tmp[i] = '\0';
-    return (strcmp(tmp, "quit") == 0) || (strcmp(tmp, "exit") == 0);
+    if (c->outoff > 0) {
+        memmove(c->outbuf, c->outbuf + c->outoff, c->outlen - c->outoff);
+        c->outlen -= c->outoff;
+        c->outoff = 0;
+    }
+    if (c->outlen + add > OUT_QUEUE_CAP) {
+        log_write(LOG_CONN, "[pid %ld] send queue overflow: %s\n",
+                  (long)getpid(), c->peer);
+        return -1;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(c->outbuf + c->outlen, iov[i].iov_base, iov[i].iov_len);
+        c->outlen += iov[i].iov_len;
+    }
+    queued_total += add;
+    return 0;
 }
 
-static int send_all(int fd, const char *buf, size_t len) {
-    size_t sent = 0;
-    while (sent < len) {
-        ssize_t n = write(fd, buf + sent, len - sent);
+/*
+ * Nonblocking counterpart of send_iov(): write what the socket accepts
+ * and park the rest in the connection's queue. If bytes are already
+ * queued, the new ones go behind them to preserve ordering. Returns 0 on
+ * success (possibly with bytes queued), -1 on hard error or overflow.
+ */
+static int send_iov_queued(int fd, struct conn *c, struct iovec *iov, int iovcnt) {
+    /* A parked broadcast must reach the wire first; writing around it
+     * would interleave the streams. */
+    if (queue_pending(c) || c->bc != NULL) {
+        return queue_append(c, iov, iovcnt);
+    }
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
         if (n < 0) {
             if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return queue_append(c, iov, iovcnt);
+            }
             return -1;
         }
-        if (n == 0) break;
-        sent += (size_t)n;
+        size_t left = (size_t)n;
+        while (iovcnt > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return 0;
+}
+
+/* Adaptive receive buffers: every connection starts at CONN_BUF_MIN and
+ * doubles toward conn_bufsize only while it keeps filling the buffer, so
+ * idle connections cost a page or two while bulk senders quickly reach
+ * full-sized reads. After CONN_QUIET_EVENTS consecutive events that used
+ * less than a quarter of the buffer, the connection shrinks back. */
+#define CONN_BUF_MIN 4096
+#define CONN_QUIET_EVENTS 16
+
+/* Double the buffer in place. The old block is bump-allocated and lives
+ * until the connection dies, but the doubling series bounds that waste
+ * below 2x the final size. */
+static int conn_grow_inbuf(struct conn *c) {
+    size_t newcap = c->incap * 2;
+    if (newcap > conn_bufsize) newcap = conn_bufsize;
+
+    char *nb = arena_alloc(c->arena, newcap);
+    if (nb == NULL) {
+        perror("ERROR growing connection buffer");
+        return -1;
     }
+    memcpy(nb, c->inbuf, c->inlen);
+    c->inbuf = nb;
+    c->incap = newcap;
     return 0;
 }
 
+/* Halve the buffer by swapping in a fresh arena, which is the only way
+ * bump allocation gives memory back. Only legal when nothing is buffered
+ * in either direction. */
+static void conn_shrink_inbuf(struct conn *c) {
+    size_t newcap = c->incap / 2;
+    if (newcap < CONN_BUF_MIN) newcap = CONN_BUF_MIN;
+
+    struct arena *na = arena_create(newcap);
+    if (na == NULL) return; /* keep the old buffer; shrinking is optional */
+    char *nb = arena_alloc(na, newcap);
+    if (nb == NULL) {
+        arena_destroy(na);
+        return;
+    }
+    arena_destroy(c->arena);
+    c->arena = na;
+    c->inbuf = nb;
+    c->incap = newcap;
+    c->outbuf = NULL; /* re-created lazily if the peer stalls again */
+    c->quiet = 0;
+}
+
+/* ---- message framing ---- */
+
+/* Messages are newline-delimited. A read() may carry several pipelined
+ * messages or only part of one, so input is buffered per connection and
+ * every complete line in the buffer is parsed in one pass, with all
+ * replies batched into a single writev. */
+
+#define REPLY_BATCH_MAX 64
+
+static int flush_replies(int fd, struct conn *c, struct iovec *iov, int *iovcnt) {
+    if (*iovcnt == 0) return 0;
+    int rc = (c != NULL) ? send_iov_queued(fd, c, iov, *iovcnt)
+                         : send_iov(fd, iov, *iovcnt);
+    *iovcnt = 0;
+    return rc;
+}
+
+#if PROTO_HAS_HUB
+/* Defined with the event-loop helpers; needs close_conn and epoll. */
+static int bcast_publish(int pubfd, const char *payload, size_t len);
+#endif
+
+#if PROTO_HAS_TEXT
+/*
+ * Parse all complete messages in data[0..*len), reply to them in one
+ * batched write, and compact any trailing partial message to the front
+ * of the buffer. Returns 1 to keep the connection open, 0 to close it
+ * (quit/exit seen, or a write failed). c is the owning connection in
+ * event-loop mode (replies that would block are queued on it) and NULL
+ * in the blocking modes.
+ */
+static int process_frames(int fd, const char *peer, char *data, size_t *len,
+                          struct conn *c) {
+    struct iovec iov[2 * REPLY_BATCH_MAX];
+    int iovcnt = 0;
+    size_t pos = 0;
+    int quit = 0;
+    uint64_t nmsgs = 0, nbytes_out = 0;
+    size_t cap = (c != NULL && c->incap > 0) ? c->incap : conn_bufsize;
+    TRACE_DECL(t);
+
+    while (pos < *len) {
+        char *start = data + pos;
+        size_t avail = *len - pos;
+        TRACE_MARK(t);
+        const char *nl = scan_find_byte(start, avail, '\n');
+        size_t msglen;
+
+        if (nl != NULL) {
+            msglen = (size_t)(nl - start) + 1;
+        } else if (pos == 0 && *len == cap - 1 && cap == conn_bufsize) {
+            /* Buffer is full at its ceiling with no delimiter: treat the
+             * whole buffer as one message rather than deadlocking against
+             * the client (below the ceiling the buffer grows instead). */
+            msglen = avail;
+        } else {
+            break; /* partial message; wait for more bytes */
+        }
+
+        /* Terminate the line in place for logging and command matching;
+         * the byte we overwrite belongs to the next message (or is the
+         * reserved slack at the end of the buffer) and is put back. */
+        char saved = start[msglen];
+        start[msglen] = '\0';
+        quit = is_quit_cmd(start);
+#if PROTO_HAS_HUB
+        int sub_cmd = 0;
+        size_t publen = 0;
+        const char *pub = NULL;
+        if (!quit) {
+            sub_cmd = is_sub_cmd(start);
+            if (!sub_cmd) pub = pub_payload(start, start + msglen, &publen);
+        }
+#endif
+        TRACE_ACCT(TRACE_PARSE, t);
+
+        TRACE_MARK(t);
+        log_write(LOG_MSG, "[pid %ld] msg from %s -> %s%s",
+                  (long)getpid(), peer, start,
+                  start[msglen - 1] == '\n' ? "" : "\n");
+        TRACE_ACCT(TRACE_LOG, t);
+
+        start[msglen] = saved;
+
+        if (quit) break;
+
+#if PROTO_HAS_HUB
+        if (sub_cmd || pub != NULL) {
+            /* Hub commands answer out of band: flush the batch so the
+             * ack lands in order, then send it on its own. */
+            if (flush_replies(fd, c, iov, &iovcnt) < 0) {
+                perror("ERROR writing to socket");
+                return 0;
+            }
+            char ack[48];
+            struct iovec one;
+            if (c == NULL || bcast_conns == NULL) {
+                one.iov_base = (void *)reply_no_hub;
+                one.iov_len = sizeof(reply_no_hub) - 1;
+            } else if (sub_cmd) {
+                c->sub = 1;
+                one.iov_base = (void *)reply_subscribed;
+                one.iov_len = sizeof(reply_subscribed) - 1;
+            } else {
+                int nsub = bcast_publish(fd, pub, publen);
+                snprintf(ack, sizeof(ack), "Sent to %d subscribers.\n", nsub);
+                one.iov_base = ack;
+                one.iov_len = strlen(ack);
+            }
+            int onecnt = 1;
+            nmsgs++;
+            nbytes_out += one.iov_len;
+            pos += msglen;
+            if (flush_replies(fd, c, &one, &onecnt) < 0) {
+                perror("ERROR writing to socket");
+                return 0;
+            }
+            continue;
+        }
+#endif /* PROTO_HAS_HUB */
+
+        TRACE_MARK(t);
+        iov[iovcnt].iov_base = (void *)reply_header;
+        iov[iovcnt].iov_len = sizeof(reply_header) - 1;
+        iovcnt++;
+        iov[iovcnt].iov_base = start;
+        iov[iovcnt].iov_len = msglen;
+        iovcnt++;
+
+        nmsgs++;
+        nbytes_out += sizeof(reply_header) - 1 + msglen;
+        pos += msglen;
+        TRACE_ACCT(TRACE_BUILD, t);
+
+        if (iovcnt == 2 * REPLY_BATCH_MAX) {
+            TRACE_MARK(t);
+            int rc = flush_replies(fd, c, iov, &iovcnt);
+            TRACE_ACCT(TRACE_WRITE, t);
+            if (rc < 0) {
+                perror("ERROR writing to socket");
+                return 0;
+            }
+        }
+    }
+
+    if (nmsgs > 0) stats_add_msgs(nmsgs, pos, nbytes_out);
+
+    if (quit) {
+        iov[iovcnt].iov_base = (void *)reply_bye;
+        iov[iovcnt].iov_len = sizeof(reply_bye) - 1;
+        iovcnt++;
+        if (flush_replies(fd, c, iov, &iovcnt) < 0) {
+            perror("ERROR writing to socket");
+        }
+        log_write(LOG_CONN, "[pid %ld] client disconnected (quit/exit): %s\n",
+                  (long)getpid(), peer);
+        return 0;
+    }
+
+    TRACE_MARK(t);
+    int flush_rc = flush_replies(fd, c, iov, &iovcnt);
+    TRACE_ACCT(TRACE_WRITE, t);
+    if (flush_rc < 0) {
+        perror("ERROR writing to socket");
+        return 0;
+    }
+
+    if (pos > 0 && pos < *len) {
+        memmove(data, data + pos, *len - pos);
+    }
+    *len -= pos;
+    return 1;
+}
+#endif /* PROTO_HAS_TEXT */
+
+/* ---- binary protocol ---- */
+
+/*
+ * Optional binary framing, negotiated by the first bytes of a connection:
+ * a client whose first four bytes are BIN_MAGIC speaks fixed 8-byte
+ * headers from then on; anything else falls through to the text parser,
+ * so existing clients are unaffected. Header fields are host
+ * (little-endian) byte order. Replies that never vary live in static
+ * constants, so serving a PING is one header compare and an iovec
+ * pointed at static storage; only ECHO builds a header per message,
+ * because its length field changes.
+ */
+
+#define BIN_MAGIC "EB01"
+#define BIN_MAGIC_LEN 4
+
+enum conn_proto {
+    PROTO_UNKNOWN = 0, /* first bytes not seen yet */
+    PROTO_TEXT,
+    PROTO_BIN
+};
+
+#if PROTO_HAS_BIN
+enum bin_type {
+    BIN_ECHO = 1, /* payload echoed back under an identical header */
+    BIN_PING = 2, /* header-only reply */
+    BIN_QUIT = 3, /* header-only reply, then close */
+    BIN_STATS = 4 /* reply payload: connections, messages, bytes in/out */
+};
+
+struct bin_hdr {
+    uint32_t type;
+    uint32_t length; /* payload bytes following this header */
+};
+
+static const struct bin_hdr bin_pong = { BIN_PING, 0 };
+static const struct bin_hdr bin_bye = { BIN_QUIT, 0 };
+static const struct bin_hdr bin_stats_hdr = { BIN_STATS, 4 * sizeof(uint64_t) };
+#endif /* PROTO_HAS_BIN */
+
+/*
+ * Inspect the first bytes of a connection. Returns PROTO_BIN (consuming
+ * the magic from the buffer) or PROTO_TEXT, or PROTO_UNKNOWN if fewer
+ * than four bytes have arrived and none of them rule the magic out yet.
+ * Single-protocol builds collapse this: text-only never looks at the
+ * bytes, binary-only consumes the magic when present and otherwise lets
+ * the frame parser reject the garbage header.
+ */
+static int negotiate_proto(char *data, size_t *len) {
+#if PROTO_HAS_BIN && PROTO_HAS_TEXT
+    size_t have = *len < BIN_MAGIC_LEN ? *len : BIN_MAGIC_LEN;
+    if (memcmp(data, BIN_MAGIC, have) != 0) return PROTO_TEXT;
+    if (have < BIN_MAGIC_LEN) return PROTO_UNKNOWN;
+
+    memmove(data, data + BIN_MAGIC_LEN, *len - BIN_MAGIC_LEN);
+    *len -= BIN_MAGIC_LEN;
+    return PROTO_BIN;
+#elif PROTO_HAS_BIN
+    size_t have = *len < BIN_MAGIC_LEN ? *len : BIN_MAGIC_LEN;
+    if (memcmp(data, BIN_MAGIC, have) != 0) return PROTO_BIN;
+    if (have < BIN_MAGIC_LEN) return PROTO_UNKNOWN;
+
+    memmove(data, data + BIN_MAGIC_LEN, *len - BIN_MAGIC_LEN);
+    *len -= BIN_MAGIC_LEN;
+    return PROTO_BIN;
+#else
+    (void)data;
+    (void)len;
+    return PROTO_TEXT;
+#endif
+}
+
+#if PROTO_HAS_BIN
+/*
+ * Binary-mode counterpart of process_frames(): handle every complete
+ * frame in data[0..*len), batch the replies into one writev, and compact
+ * any trailing partial frame. Returns 1 to keep the connection open, 0
+ * to close it (QUIT frame, malformed frame, or a write failed).
+ */
+static int process_frames_bin(int fd, const char *peer, char *data, size_t *len,
+                              struct conn *c) {
+    struct bin_hdr echo_hdrs[REPLY_BATCH_MAX];
+    struct iovec iov[2 * REPLY_BATCH_MAX];
+    uint64_t stats_vals[4];
+    int iovcnt = 0, nhdrs = 0;
+    size_t pos = 0;
+    int quit = 0;
+    uint64_t nmsgs = 0, nbytes_out = 0;
+
+    while (pos + sizeof(struct bin_hdr) <= *len) {
+        struct bin_hdr hdr;
+        memcpy(&hdr, data + pos, sizeof(hdr)); /* data + pos may be unaligned */
+
+        if (hdr.length > conn_bufsize - 1 - sizeof(hdr)) {
+            log_write(LOG_CONN, "[pid %ld] oversized frame (%u bytes) from %s\n",
+                      (long)getpid(), hdr.length, peer);
+            return 0;
+        }
+        if (pos + sizeof(hdr) + hdr.length > *len) break; /* partial frame */
+
+        char *payload = data + pos + sizeof(hdr);
+
+        log_write(LOG_MSG, "[pid %ld] frame type %u len %u from %s\n",
+                  (long)getpid(), hdr.type, hdr.length, peer);
+
+        if (hdr.type == BIN_QUIT) {
+            quit = 1;
+            break;
+        }
+
+        switch (hdr.type) {
+        case BIN_ECHO:
+            echo_hdrs[nhdrs].type = BIN_ECHO;
+            echo_hdrs[nhdrs].length = hdr.length;
+            iov[iovcnt].iov_base = &echo_hdrs[nhdrs];
+            iov[iovcnt].iov_len = sizeof(struct bin_hdr);
+            iovcnt++;
+            nhdrs++;
+            iov[iovcnt].iov_base = payload;
+            iov[iovcnt].iov_len = hdr.length;
+            iovcnt++;
+            nbytes_out += sizeof(struct bin_hdr) + hdr.length;
+            break;
+        case BIN_PING:
+            iov[iovcnt].iov_base = (void *)&bin_pong;
+            iov[iovcnt].iov_len = sizeof(bin_pong);
+            iovcnt++;
+            nbytes_out += sizeof(bin_pong);
+            break;
+        case BIN_STATS:
+            stats_snapshot(stats_vals);
+            iov[iovcnt].iov_base = (void *)&bin_stats_hdr;
+            iov[iovcnt].iov_len = sizeof(bin_stats_hdr);
+            iovcnt++;
+            iov[iovcnt].iov_base = stats_vals;
+            iov[iovcnt].iov_len = sizeof(stats_vals);
+            iovcnt++;
+            nbytes_out += sizeof(bin_stats_hdr) + sizeof(stats_vals);
+            /* stats_vals is reused per frame, so the reply cannot sit in
+             * the batch while a later STATS frame overwrites it */
+            if (flush_replies(fd, c, iov, &iovcnt) < 0) {
+                perror("ERROR writing to socket");
+                return 0;
+            }
+            nhdrs = 0;
+            break;
+        default:
+            log_write(LOG_CONN, "[pid %ld] unknown frame type %u from %s\n",
+                      (long)getpid(), hdr.type, peer);
+            return 0;
+        }
+
+        nmsgs++;
+        pos += sizeof(hdr) + hdr.length;
+
+        if (nhdrs == REPLY_BATCH_MAX || iovcnt >= 2 * REPLY_BATCH_MAX - 1) {
+            if (flush_replies(fd, c, iov, &iovcnt) < 0) {
+                perror("ERROR writing to socket");
+                return 0;
+            }
+            nhdrs = 0;
+        }
+    }
+
+    if (nmsgs > 0) stats_add_msgs(nmsgs, pos, nbytes_out);
+
+    if (quit) {
+        iov[iovcnt].iov_base = (void *)&bin_bye;
+        iov[iovcnt].iov_len = sizeof(bin_bye);
+        iovcnt++;
+        if (flush_replies(fd, c, iov, &iovcnt) < 0) {
+            perror("ERROR writing to socket");
+        }
+        log_write(LOG_CONN, "[pid %ld] client disconnected (QUIT frame): %s\n",
+                  (long)getpid(), peer);
+        return 0;
+    }
+
+    if (flush_replies(fd, c, iov, &iovcnt) < 0) {
+        perror("ERROR writing to socket");
+        return 0;
+    }
+
+    if (pos > 0 && pos < *len) {
+        memmove(data, data + pos, *len - pos);
+    }
+    *len -= pos;
+    return 1;
+}
+#endif /* PROTO_HAS_BIN */
+
+/* Protocol dispatch: in single-variant builds the branch folds away and
+ * the per-message path stays monomorphic. */
+static int parse_frames(int fd, const char *peer, char *data, size_t *len,
+                        struct conn *c, int proto) {
+#if PROTO_HAS_BIN && PROTO_HAS_TEXT
+    return proto == PROTO_BIN
+               ? process_frames_bin(fd, peer, data, len, c)
+               : process_frames(fd, peer, data, len, c);
+#elif PROTO_HAS_BIN
+    (void)proto;
+    return process_frames_bin(fd, peer, data, len, c);
+#else
+    (void)proto;
+    return process_frames(fd, peer, data, len, c);
+#endif
+}
+
 static void handle_client_loop(int fd, const struct sockaddr_in *cli_addr) {
-    char buffer[256];
+    char peer[PEER_STR_MAX];
+    struct arena *arena = arena_create(conn_bufsize);
+    if (arena == NULL) {
+        perror("ERROR creating connection arena");
+        return;
+    }
+    char *buffer = arena_alloc(arena, conn_bufsize);
+    size_t buflen = 0;
+    int proto = PROTO_UNKNOWN;
+    if (buffer == NULL) {
+        perror("ERROR allocating connection buffer");
+        arena_destroy(arena);
+        return;
+    }
 
-    printf("[pid %ld] connected: %s:%u\n",
-           (long)getpid(),
-           inet_ntoa(cli_addr->sin_addr),
-           ntohs(cli_addr->sin_port));
-    fflush(stdout);
+    format_peer(cli_addr, peer, sizeof(peer));
+    log_write(LOG_CONN, "[pid %ld] connected: %s\n", (long)getpid(), peer);
 
+    TRACE_DECL(t);
     while (1) {
-        memset(buffer, 0, sizeof(buffer));
-
-        ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+        TRACE_MARK(t);
+        ssize_t n = read(fd, buffer + buflen, conn_bufsize - 1 - buflen);
+        TRACE_ACCT(TRACE_READ, t);
         if (n < 0) {
             if (errno == EINTR) continue;
-            die("ERROR reading from socket");
+            /* A per-connection error must not take down thread-pool workers. */
+            perror("ERROR reading from socket");
+            break;
         }
         if (n == 0) {
             /* client closed connection */
-            printf("[pid %ld] client disconnected: %s:%u\n",
-                   (long)getpid(),
-                   inet_ntoa(cli_addr->sin_addr),
-                   ntohs(cli_addr->sin_port));
-            fflush(stdout);
+            log_write(LOG_CONN, "[pid %ld] client disconnected: %s\n",
+                      (long)getpid(), peer);
             break;
         }
 
-        /* Ensure buffer is NUL-terminated (read already left room) */
-        buffer[n] = '\0';
+        buflen += (size_t)n;
+        if (proto == PROTO_UNKNOWN) {
+            proto = negotiate_proto(buffer, &buflen);
+            if (proto == PROTO_UNKNOWN) continue;
+        }
+        int keep = parse_frames(fd, peer, buffer, &buflen, NULL, proto);
+        if (!keep) break;
+    }
 
-        printf("[pid %ld] msg from %s:%u -> %s",
-               (long)getpid(),
-               inet_ntoa(cli_addr->sin_addr),
-               ntohs(cli_addr->sin_port),
-               buffer);
-        if (buffer[n - 1] != '\n') printf("\n");
-        fflush(stdout);
+    arena_destroy(arena);
+}
 
-        if (is_quit_cmd(buffer)) {
-            const char *bye = "Bye.\n";
-            if (send_all(fd, bye, strlen(bye)) < 0) {
-                perror("ERROR writing to socket");
-            }
-            printf("[pid %ld] client disconnected (quit/exit): %s:%u\n",
-            (long)getpid(),
-            inet_ntoa(cli_addr->sin_addr),
-            ntohs(cli_addr->sin_port));
-            fflush(stdout);
+/*
+ * Zero-copy echo: move bytes socket -> pipe -> socket with splice(), so
+ * payloads stay in the kernel. Used for bulk-transfer throughput tests
+ * where the per-message protocol (and its user/kernel copies) would be
+ * the bottleneck.
+ */
+static void handle_client_splice(int fd, const struct sockaddr_in *cli_addr) {
+    int pipefd[2];
+    char peer[PEER_STR_MAX];
+
+    format_peer(cli_addr, peer, sizeof(peer));
+    log_write(LOG_CONN, "[pid %ld] connected (splice echo): %s\n",
+              (long)getpid(), peer);
+
+    if (pipe(pipefd) < 0) {
+        perror("ERROR creating pipe");
+        return;
+    }
+
+    while (1) {
+        ssize_t n = splice(fd, NULL, pipefd[1], NULL, 1 << 20,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("ERROR splicing from socket");
             break;
         }
+        if (n == 0) break; /* client closed connection */
 
-        const char *reply = "I got your message\n";
-        if (send_all(fd, reply, strlen(reply)) < 0) {
-            die("ERROR writing to socket");
+        ssize_t left = n;
+        while (left > 0) {
+            ssize_t m = splice(pipefd[0], NULL, fd, NULL, (size_t)left,
+                               SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (m < 0) {
+                if (errno == EINTR) continue;
+                perror("ERROR splicing to socket");
+                goto out;
+            }
+            left -= m;
         }
     }
+
+out:
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    log_write(LOG_CONN, "[pid %ld] client disconnected: %s\n",
+              (long)getpid(), peer);
 }
 
-int main(int argc, char *argv[]) {
-    int sockfd;
-    int portno;
-    struct sockaddr_in serv_addr;
+/* ---- epoll event-loop mode ---- */
 
-    if (argc < 2) {
-        fprintf(stderr, "ERROR, no port provided\n");
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Same listener contract as create_listen_socket, but bound to a
+ * filesystem path. A stale socket file from a previous run is unlinked
+ * first, mirroring what SO_REUSEADDR buys the TCP listener. */
+static int create_listen_socket_unix(const char *path) {
+    struct sockaddr_un serv_addr;
+    if (strlen(path) >= sizeof(serv_addr.sun_path)) {
+        fprintf(stderr, "ERROR, socket path too long: %s\n", path);
         exit(1);
     }
-    portno = atoi(argv[1]);
 
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd < 0) die("ERROR opening socket");
+
+    unlink(path);
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sun_family = AF_UNIX;
+    strcpy(serv_addr.sun_path, path);
+
+    if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) die("ERROR on binding");
+    if (listen(sockfd, tuning.backlog) < 0) die("ERROR on listen");
+
+    return sockfd;
+}
+
+static int create_listen_socket(int portno, int reuseport) {
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) die("ERROR opening socket");
 
     int optval = 1;
     if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) {
         die("ERROR setsockopt(SO_REUSEADDR)");
     }
+    if (reuseport &&
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+        die("ERROR setsockopt(SO_REUSEPORT)");
+    }
 
+    struct sockaddr_in serv_addr;
     memset(&serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = INADDR_ANY;
     serv_addr.sin_port = htons((uint16_t)portno);
 
     if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) die("ERROR on binding");
-    if (listen(sockfd, 5) < 0) die("ERROR on listen");
+    if (listen(sockfd, tuning.backlog) < 0) die("ERROR on listen");
 
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = reap_children;
-    sa.sa_flags = SA_RESTART;
-    sigemptyset(&sa.sa_mask);
-    if (sigaction(SIGCHLD, &sa, NULL) < 0) die("ERROR sigaction(SIGCHLD)");
+    return sockfd;
+}
 
-    printf("Server listening on port %d (pid %ld)\n", portno, (long)getpid());
-    fflush(stdout);
+/* Best-effort per-connection tuning; a failed setsockopt is logged but
+ * never fatal, since these are performance knobs, not correctness. */
+static void apply_conn_tuning(int fd) {
+    int one = 1;
+    if (unix_path != NULL) {
+        /* No TCP underneath; only the socket-buffer knob applies. */
+        goto bufs;
+    }
+    if (tuning.nodelay &&
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+        perror("ERROR setsockopt(TCP_NODELAY)");
+    }
+    if (tuning.quickack &&
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one)) < 0) {
+        perror("ERROR setsockopt(TCP_QUICKACK)");
+    }
+    if (tuning.keepalive &&
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one)) < 0) {
+        perror("ERROR setsockopt(SO_KEEPALIVE)");
+    }
+bufs:
+    if (tuning.sockbuf > 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &tuning.sockbuf,
+                       sizeof(tuning.sockbuf)) < 0) {
+            perror("ERROR setsockopt(SO_RCVBUF)");
+        }
+        if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &tuning.sockbuf,
+                       sizeof(tuning.sockbuf)) < 0) {
+            perror("ERROR setsockopt(SO_SNDBUF)");
+        }
+    }
+}
 
-    while (1) {
-        struct sockaddr_in cli_addr;
-        socklen_t clilen = sizeof(cli_addr);
+/*
+ * Pin the calling process to one core, round robin over what is online.
+ * With the default of one worker per core each worker owns a core, and
+ * every page the worker maps afterwards (arenas, buffers) is placed on
+ * that core's NUMA node by the kernel's first-touch policy, so no
+ * explicit NUMA library is needed. Returns the chosen cpu, or -1.
+ */
+static int pin_to_cpu(int worker_idx) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) return -1;
+    int cpu = worker_idx % (int)ncpu;
 
-        int newsockfd = accept(sockfd, (struct sockaddr *)&cli_addr, &clilen);
-        if (newsockfd < 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        perror("ERROR sched_setaffinity");
+        return -1;
+    }
+    return cpu;
+}
+
+/* ---- idle-connection timer wheel ---- */
+
+/*
+ * Hashed wheel with one-second ticks: a connection is linked into the
+ * slot its deadline hashes to, so (re)scheduling on every event and
+ * expiring a tick are both O(1) amortized no matter how many idle
+ * connections exist. Slots are doubly-linked lists threaded through the
+ * fd-indexed connection table, so no allocation happens per timer.
+ */
+#define TW_SLOTS 256
+
+static int tw_wheel[TW_SLOTS];
+
+static void tw_init(void) {
+    for (int i = 0; i < TW_SLOTS; i++) tw_wheel[i] = -1;
+}
+
+static uint64_t tw_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec;
+}
+
+static void tw_remove(struct conn *conns, int fd) {
+    struct conn *c = &conns[fd];
+    if (c->tw_prev == -1 && c->tw_next == -1 &&
+        tw_wheel[c->deadline % TW_SLOTS] != fd) {
+        return; /* not scheduled */
+    }
+    if (c->tw_prev != -1) {
+        conns[c->tw_prev].tw_next = c->tw_next;
+    } else {
+        tw_wheel[c->deadline % TW_SLOTS] = c->tw_next;
+    }
+    if (c->tw_next != -1) conns[c->tw_next].tw_prev = c->tw_prev;
+    c->tw_next = -1;
+    c->tw_prev = -1;
+}
+
+static void tw_schedule(struct conn *conns, int fd, uint64_t now) {
+    struct conn *c = &conns[fd];
+    tw_remove(conns, fd);
+    c->deadline = now + (uint64_t)idle_timeout;
+    int slot = (int)(c->deadline % TW_SLOTS);
+    c->tw_prev = -1;
+    c->tw_next = tw_wheel[slot];
+    if (c->tw_next != -1) conns[c->tw_next].tw_prev = fd;
+    tw_wheel[slot] = fd;
+}
+
+static void close_conn(int epfd, struct conn *conns, int fd);
+
+/* Walk every tick between the last sweep and now, closing connections
+ * whose deadline has passed. Entries hashed into the same slot for a
+ * later round are skipped by the deadline check. */
+static void tw_expire(int epfd, struct conn *conns, uint64_t *last, uint64_t now) {
+    if (now - *last > TW_SLOTS) *last = now - TW_SLOTS; /* don't rescan slots */
+
+    for (uint64_t t = *last + 1; t <= now; t++) {
+        int fd = tw_wheel[t % TW_SLOTS];
+        while (fd != -1) {
+            int next = conns[fd].tw_next;
+            if (conns[fd].deadline <= now) {
+                struct iovec iov = {
+                    .iov_base = (void *)reply_bye,
+                    .iov_len = sizeof(reply_bye) - 1
+                };
+                send_iov(fd, &iov, 1);
+                log_write(LOG_CONN, "[pid %ld] client disconnected (idle timeout): %s\n",
+                          (long)getpid(), conns[fd].peer);
+                close_conn(epfd, conns, fd);
+            }
+            fd = next;
+        }
+    }
+    *last = now;
+}
+
+static void close_conn(int epfd, struct conn *conns, int fd) {
+    if (conns[fd].active) live_conns--;
+    queued_total -= conn_backlog(&conns[fd]);
+    if (conns[fd].bc != NULL) bcast_put(conns[fd].bc);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    tw_remove(conns, fd);
+    if (conns[fd].arena != NULL) arena_destroy(conns[fd].arena);
+    memset(&conns[fd], 0, sizeof(conns[fd]));
+    conns[fd].tw_next = -1;
+    conns[fd].tw_prev = -1;
+}
+
+static void conn_set_events(int epfd, int fd, uint32_t mask) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = mask | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        perror("ERROR epoll_ctl(mod)");
+    }
+}
+
+/*
+ * Run the connection's parser and react to what it left behind: if the
+ * send queue holds bytes, switch the connection to EPOLLOUT until they
+ * drain (watching EPOLLIN too would spin, level-triggered, on the unread
+ * input we are deliberately not consuming); if the parser asked to close
+ * while bytes are queued, the goodbye drains first.
+ */
+/* Close the worst offenders until total parked output is back under the
+ * global cap. The linear scan only runs while the cap is exceeded, which
+ * is already an incident, not a hot path. */
+static void shed_queued(int epfd, struct conn *conns) {
+    while (queued_total > QUEUED_GLOBAL_MAX) {
+        int worst = -1;
+        size_t worst_backlog = 0;
+        for (size_t i = 0; i < conn_table_size; i++) {
+            if (conns[i].active && conn_backlog(&conns[i]) > worst_backlog) {
+                worst_backlog = conn_backlog(&conns[i]);
+                worst = (int)i;
+            }
+        }
+        if (worst < 0) break;
+        log_write(LOG_CONN, "[pid %ld] shedding slow consumer (%zu queued): %s\n",
+                  (long)getpid(), worst_backlog, conns[worst].peer);
+        close_conn(epfd, conns, worst);
+    }
+}
+
+/* Re-derive the event mask for a connection with parked output: pause
+ * reads above the high watermark, otherwise drain opportunistically. */
+static void conn_apply_backpressure(int epfd, struct conn *conns, int fd) {
+    struct conn *c = &conns[fd];
+    if (!queue_pending(c) && c->bc == NULL) return;
+    if (conn_backlog(c) > OUT_HIGH_WATER) {
+        c->paused = 1;
+        conn_set_events(epfd, fd, EPOLLOUT);
+    } else {
+        conn_set_events(epfd, fd, EPOLLIN | EPOLLOUT);
+    }
+}
+
+#if PROTO_HAS_HUB
+/*
+ * Deliver one shared payload to every subscriber on the worker. Fast
+ * receivers take the bytes in the writev right here and hold no
+ * reference; a blocked one parks a reference plus offset, resumed from
+ * handle_client_writable; one already backlogged falls back to a copy
+ * behind its queued bytes (ordering demands it), governed by the same
+ * watermarks as any backlog. Returns the number of subscribers reached.
+ */
+static int bcast_publish(int pubfd, const char *payload, size_t len) {
+    struct conn *conns = bcast_conns;
+    int nsub = 0;
+
+    struct bcast_buf *b = bcast_get(payload, len);
+    if (b == NULL) {
+        perror("ERROR allocating broadcast buffer");
+        return 0;
+    }
+
+    for (size_t i = 0; i < conn_table_size; i++) {
+        struct conn *s = &conns[i];
+        if (!s->active || !s->sub || (int)i == pubfd) continue;
+
+        if (queue_pending(s) || s->bc != NULL) {
+            struct iovec iov[2] = {
+                { (void *)bcast_header, BCAST_HDR_LEN },
+                { b->data, b->len }
+            };
+            if (queue_append(s, iov, 2) < 0) {
+                close_conn(bcast_epfd, conns, (int)i);
+                continue;
+            }
+        } else {
+            size_t off = 0;
+            while (off < BCAST_HDR_LEN + b->len) {
+                struct iovec iov[2];
+                int cnt = 0;
+                if (off < BCAST_HDR_LEN) {
+                    iov[cnt].iov_base = (void *)(bcast_header + off);
+                    iov[cnt].iov_len = BCAST_HDR_LEN - off;
+                    cnt++;
+                    iov[cnt].iov_base = b->data;
+                    iov[cnt].iov_len = b->len;
+                    cnt++;
+                } else {
+                    iov[cnt].iov_base = b->data + (off - BCAST_HDR_LEN);
+                    iov[cnt].iov_len = b->len - (off - BCAST_HDR_LEN);
+                    cnt++;
+                }
+                ssize_t n = writev((int)i, iov, cnt);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        b->refs++;
+                        s->bc = b;
+                        s->bc_off = off;
+                        queued_total += BCAST_HDR_LEN + b->len - off;
+                        break;
+                    }
+                    perror("ERROR writing to socket");
+                    close_conn(bcast_epfd, conns, (int)i);
+                    break;
+                }
+                off += (size_t)n;
+            }
+            if (!s->active) continue;
+        }
+        conn_apply_backpressure(bcast_epfd, conns, (int)i);
+        nsub++;
+    }
+
+    bcast_put(b);
+    return nsub;
+}
+#endif /* PROTO_HAS_HUB */
+
+static void conn_parse(int epfd, struct conn *conns, int fd) {
+    struct conn *c = &conns[fd];
+
+    int keep = parse_frames(fd, c->peer, c->inbuf, &c->inlen, c, c->proto);
+    if (!keep) {
+        if (queue_pending(c) || c->bc != NULL) {
+            c->closing = 1;
+            conn_set_events(epfd, fd, EPOLLOUT);
+        } else {
+            close_conn(epfd, conns, fd);
+        }
+        return;
+    }
+    conn_apply_backpressure(epfd, conns, fd);
+    if (queued_total > QUEUED_GLOBAL_MAX) shed_queued(epfd, conns);
+}
+
+/*
+ * Serve one readable event for a connection: same read/echo/quit semantics
+ * as handle_client_loop(), but driven edge-triggered, so the socket is
+ * drained to EAGAIN before going back to epoll_wait. A full buffer below
+ * the ceiling grows; at the ceiling it is parsed mid-drain so compaction
+ * frees room for the rest of the socket's backlog.
+ */
+static void handle_client_event(int epfd, struct conn *conns, int fd) {
+    struct conn *c = &conns[fd];
+
+    if (c->paused) return; /* reads resume at the low watermark */
+
+    size_t event_bytes = 0;
+    TRACE_DECL(t);
+    while (1) {
+        size_t space = c->incap - 1 - c->inlen;
+        if (space == 0) {
+            if (c->incap < conn_bufsize) {
+                if (conn_grow_inbuf(c) < 0) {
+                    close_conn(epfd, conns, fd);
+                    return;
+                }
+                continue;
+            }
+            if (c->proto == PROTO_UNKNOWN) {
+                c->proto = negotiate_proto(c->inbuf, &c->inlen);
+            }
+            conn_parse(epfd, conns, fd);
+            if (!c->active || c->paused) return;
+            continue;
+        }
+
+        TRACE_MARK(t);
+        ssize_t n = read(fd, c->inbuf + c->inlen, space);
+        TRACE_ACCT(TRACE_READ, t);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            perror("ERROR reading from socket");
+            close_conn(epfd, conns, fd);
+            return;
+        }
+        if (n == 0) {
+            log_write(LOG_CONN, "[pid %ld] client disconnected: %s\n",
+                      (long)getpid(), c->peer);
+            close_conn(epfd, conns, fd);
+            return;
+        }
+        c->inlen += (size_t)n;
+        event_bytes += (size_t)n;
+        if ((size_t)n < space) break; /* short read: socket is drained */
+    }
+
+    if (idle_timeout > 0) tw_schedule(conns, fd, tw_now());
+    if (c->proto == PROTO_UNKNOWN) {
+        c->proto = negotiate_proto(c->inbuf, &c->inlen);
+        if (c->proto == PROTO_UNKNOWN) return;
+    }
+    conn_parse(epfd, conns, fd);
+    if (!c->active) return;
+
+    /* Shrink bookkeeping: a run of events that never used a quarter of
+     * the buffer means the connection stopped being chatty. */
+    if (c->incap > CONN_BUF_MIN && c->inlen == 0 && !queue_pending(c)) {
+        if (event_bytes < c->incap / 4) {
+            if (++c->quiet >= CONN_QUIET_EVENTS) conn_shrink_inbuf(c);
+        } else {
+            c->quiet = 0;
+        }
+    }
+}
+
+/*
+ * Drain the send queue on EPOLLOUT. Once empty, either finish a pending
+ * close or hand the connection back to EPOLLIN; input that arrived in
+ * the buffer while we were write-blocked is parsed right away.
+ */
+static void handle_client_writable(int epfd, struct conn *conns, int fd) {
+    struct conn *c = &conns[fd];
+    int blocked = 0;
+
+#if PROTO_HAS_HUB
+    /* A parked broadcast was first in line; finish it before the copied
+     * queue so the byte stream stays in publish order. */
+    while (c->bc != NULL) {
+        struct iovec iov[2];
+        int cnt = 0;
+        if (c->bc_off < BCAST_HDR_LEN) {
+            iov[cnt].iov_base = (void *)(bcast_header + c->bc_off);
+            iov[cnt].iov_len = BCAST_HDR_LEN - c->bc_off;
+            cnt++;
+            iov[cnt].iov_base = c->bc->data;
+            iov[cnt].iov_len = c->bc->len;
+            cnt++;
+        } else {
+            iov[cnt].iov_base = c->bc->data + (c->bc_off - BCAST_HDR_LEN);
+            iov[cnt].iov_len = c->bc->len - (c->bc_off - BCAST_HDR_LEN);
+            cnt++;
+        }
+        ssize_t n = writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                blocked = 1;
+                break;
+            }
+            perror("ERROR writing to socket");
+            close_conn(epfd, conns, fd);
+            return;
+        }
+        c->bc_off += (size_t)n;
+        queued_total -= (size_t)n;
+        if (c->bc_off == BCAST_HDR_LEN + c->bc->len) {
+            bcast_put(c->bc);
+            c->bc = NULL;
+            c->bc_off = 0;
+        }
+    }
+#endif /* PROTO_HAS_HUB */
+
+    while (!blocked && c->outoff < c->outlen) {
+        ssize_t n = write(fd, c->outbuf + c->outoff, c->outlen - c->outoff);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            perror("ERROR writing to socket");
+            close_conn(epfd, conns, fd);
+            return;
+        }
+        c->outoff += (size_t)n;
+        queued_total -= (size_t)n;
+    }
+
+    if (c->bc == NULL && c->outoff == c->outlen) {
+        c->outlen = 0;
+        c->outoff = 0;
+
+        if (c->closing) {
+            close_conn(epfd, conns, fd);
+            return;
+        }
+
+        c->paused = 0;
+        conn_set_events(epfd, fd, EPOLLIN);
+        if (c->inlen > 0) conn_parse(epfd, conns, fd);
+        return;
+    }
+
+    /* Partial drain: reads come back at the low watermark, not at
+     * empty, so a trickling peer can't flap the event mask. */
+    if (c->paused && conn_backlog(c) <= OUT_LOW_WATER) {
+        c->paused = 0;
+        conn_set_events(epfd, fd, EPOLLIN | EPOLLOUT);
+    }
+}
+
+/*
+ * Connection-state slab: one fixed-size slot per possible fd, sized from
+ * the process fd limit and indexed directly by fd. The per-event lookup
+ * is a single array index -- no hashing, no pointer chase -- and nothing
+ * is allocated on the accept path; a slot is simply reused when its fd
+ * comes around again. Slots are cache-line aligned so the hot first line
+ * of one connection never straddles into its neighbour's.
+ */
+static struct conn *conn_table_create(size_t *out_max_fds) {
+    struct rlimit rl;
+    size_t max_fds = 1024;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        max_fds = (size_t)rl.rlim_cur;
+    }
+
+    struct conn *conns = aligned_alloc(64, max_fds * sizeof(*conns));
+    if (conns == NULL) die("ERROR allocating connection table");
+    memset(conns, 0, max_fds * sizeof(*conns));
+    for (size_t i = 0; i < max_fds; i++) {
+        conns[i].tw_next = -1;
+        conns[i].tw_prev = -1;
+    }
+
+    conn_table_size = max_fds;
+    *out_max_fds = max_fds;
+    return conns;
+}
+
+static void run_epoll_loop(int sockfd) {
+    size_t max_fds;
+    struct conn *conns = conn_table_create(&max_fds);
+    tw_init();
+
+    /* Enables the sub/pub hub commands for this worker's connections. */
+#if PROTO_HAS_HUB
+    bcast_conns = conns;
+#endif
+
+    if (set_nonblocking(sockfd) < 0) die("ERROR setting listen socket nonblocking");
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0) die("ERROR epoll_create1");
+#if PROTO_HAS_HUB
+    bcast_epfd = epfd;
+#endif
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = sockfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0) die("ERROR epoll_ctl(listen)");
+
+    struct epoll_event events[64];
+    uint64_t last_sweep = tw_now();
+    int listening = 1;
+
+    while (1) {
+        if (draining) {
+            if (listening) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, sockfd, NULL);
+                close(sockfd);
+                listening = 0;
+                log_write(LOG_CONN, "[pid %ld] draining: stopped accepting\n",
+                          (long)getpid());
+            }
+            if (atomic_load(&live_conns) == 0) break;
+        }
+
+        int wait_ms = idle_timeout > 0 ? 500 : -1;
+        int nready = epoll_wait(epfd, events, (int)(sizeof(events) / sizeof(events[0])), wait_ms);
+        if (nready < 0) {
+            if (errno == EINTR) continue;
+            die("ERROR epoll_wait");
+        }
+
+        if (idle_timeout > 0) {
+            uint64_t now = tw_now();
+            if (now > last_sweep) tw_expire(epfd, conns, &last_sweep, now);
+        }
+
+        for (int i = 0; i < nready; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == sockfd) {
+                if (!listening) continue;
+                /* Accept everything that is pending before going back to
+                 * wait: one wakeup absorbs the whole burst, and accept4
+                 * hands each socket back already nonblocking, so the
+                 * per-connection fcntl round trips are gone entirely. */
+                while (1) {
+                    struct sockaddr_in cli_addr;
+                    socklen_t clilen = sizeof(cli_addr);
+
+                    int newsockfd = accept4(sockfd, (struct sockaddr *)&cli_addr,
+                                            &clilen, SOCK_NONBLOCK);
+                    if (newsockfd < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                        if (errno == EINTR) continue;
+                        perror("ERROR on accept");
+                        break;
+                    }
+
+                    if ((size_t)newsockfd >= max_fds) {
+                        fprintf(stderr, "ERROR fd %d beyond connection table\n", newsockfd);
+                        close(newsockfd);
+                        continue;
+                    }
+
+                    apply_conn_tuning(newsockfd);
+                    stats_add_conn();
+
+                    size_t initcap = CONN_BUF_MIN < conn_bufsize
+                                         ? CONN_BUF_MIN : conn_bufsize;
+                    conns[newsockfd].arena = arena_create(initcap);
+                    if (conns[newsockfd].arena == NULL) {
+                        perror("ERROR creating connection arena");
+                        close(newsockfd);
+                        continue;
+                    }
+                    conns[newsockfd].inbuf =
+                        arena_alloc(conns[newsockfd].arena, initcap);
+                    conns[newsockfd].inlen = 0;
+                    conns[newsockfd].incap = initcap;
+                    conns[newsockfd].active = 1;
+                    conns[newsockfd].addr = cli_addr;
+                    conns[newsockfd].tw_next = -1;
+                    conns[newsockfd].tw_prev = -1;
+                    format_peer(&cli_addr, conns[newsockfd].peer,
+                                sizeof(conns[newsockfd].peer));
+                    if (idle_timeout > 0) {
+                        tw_schedule(conns, newsockfd, tw_now());
+                    }
+
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = EPOLLIN | EPOLLET;
+                    ev.data.fd = newsockfd;
+                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, newsockfd, &ev) < 0) {
+                        perror("ERROR epoll_ctl(client)");
+                        close(newsockfd);
+                        arena_destroy(conns[newsockfd].arena);
+                        memset(&conns[newsockfd], 0, sizeof(conns[newsockfd]));
+                        continue;
+                    }
+
+                    live_conns++;
+                    log_write(LOG_CONN, "[pid %ld] connected: %s\n",
+                              (long)getpid(), conns[newsockfd].peer);
+                }
+                continue;
+            }
+
+            if (!conns[fd].active) continue;
+
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                close_conn(epfd, conns, fd);
+                continue;
+            }
+
+            if (events[i].events & EPOLLOUT) {
+                handle_client_writable(epfd, conns, fd);
+            } else {
+                handle_client_event(epfd, conns, fd);
+            }
+        }
+    }
+}
+
+/* ---- pre-forked worker pool ---- */
+
+/*
+ * Fork nworkers children. Each worker binds its own SO_REUSEPORT listening
+ * socket on the same port and runs the epoll loop, so the kernel shards
+ * incoming connections across workers and there is no shared accept()
+ * for them to thunder on.
+ */
+static void run_prefork_pool(int portno, int nworkers) {
+    pid_t *pids = calloc((size_t)nworkers, sizeof(*pids));
+    if (pids == NULL) die("ERROR allocating worker pid table");
+
+    for (int w = 0; w < nworkers; w++) {
+        pid_t pid = fork();
+        if (pid < 0) die("ERROR on fork (worker)");
+
+        if (pid == 0) {
+            int cpu = pin_workers ? pin_to_cpu(w) : -1;
+            int sockfd = create_listen_socket(portno, 1);
+#ifdef SO_INCOMING_CPU
+            /* Steer connections whose packets arrive on this worker's
+             * core to this worker's listener, so a connection's softirq,
+             * worker, and buffers stay on one node. Best-effort. */
+            if (cpu >= 0 &&
+                setsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU,
+                           &cpu, sizeof(cpu)) < 0) {
+                perror("ERROR setsockopt(SO_INCOMING_CPU)");
+            }
+#else
+            (void)cpu;
+#endif
+            stats_attach();
+            log_init();
+            printf("[pid %ld] worker %d listening on port %d\n",
+                   (long)getpid(), w, portno);
+            fflush(stdout);
+            run_epoll_loop(sockfd);
+            _exit(0);
+        }
+        pids[w] = pid;
+    }
+
+    /* Parent just supervises; a SIGTERM is relayed once so every worker
+     * drains, and the parent exits when the last one has. */
+    int relayed = 0;
+    int left = nworkers;
+    while (left > 0) {
+        if (draining && !relayed) {
+            for (int w = 0; w < nworkers; w++) kill(pids[w], SIGTERM);
+            relayed = 1;
+        }
+        if (wait(NULL) > 0) {
+            left--;
+            continue;
+        }
+        if (errno != EINTR) break;
+    }
+    free(pids);
+}
+
+/* ---- thread-pool mode ---- */
+
+#define FD_QUEUE_CAP 1024
+
+/*
+ * Per-thread connection queue. One producer (the acceptor) and one
+ * consumer (the owning worker thread), so the mutex is barely contended;
+ * the acceptor blocks only if a worker's queue is completely full.
+ */
+struct fd_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    int fds[FD_QUEUE_CAP];
+    struct sockaddr_in addrs[FD_QUEUE_CAP];
+    size_t head;
+    size_t tail;
+    size_t count;
+};
+
+static void fd_queue_init(struct fd_queue *q) {
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void fd_queue_push(struct fd_queue *q, int fd, const struct sockaddr_in *addr) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == FD_QUEUE_CAP) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    q->fds[q->tail] = fd;
+    q->addrs[q->tail] = *addr;
+    q->tail = (q->tail + 1) % FD_QUEUE_CAP;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int fd_queue_pop(struct fd_queue *q, struct sockaddr_in *addr) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    int fd = q->fds[q->head];
+    *addr = q->addrs[q->head];
+    q->head = (q->head + 1) % FD_QUEUE_CAP;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return fd;
+}
+
+static void *thread_worker(void *arg) {
+    struct fd_queue *q = arg;
+
+    stats_attach();
+
+    while (1) {
+        struct sockaddr_in cli_addr;
+        int fd = fd_queue_pop(q, &cli_addr);
+        if (zero_copy_echo) handle_client_splice(fd, &cli_addr);
+        else handle_client_loop(fd, &cli_addr);
+        close(fd);
+        live_conns--;
+    }
+
+    return NULL;
+}
+
+static void run_thread_pool(int sockfd, int nthreads) {
+    struct fd_queue *queues = calloc((size_t)nthreads, sizeof(*queues));
+    pthread_t *threads = calloc((size_t)nthreads, sizeof(*threads));
+    if (queues == NULL || threads == NULL) die("ERROR allocating thread pool");
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int t = 0; t < nthreads; t++) {
+        fd_queue_init(&queues[t]);
+        if (pthread_create(&threads[t], NULL, thread_worker, &queues[t]) != 0) {
+            die("ERROR creating worker thread");
+        }
+        if (pin_workers && ncpu > 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(t % (int)ncpu, &set);
+            if (pthread_setaffinity_np(threads[t], sizeof(set), &set) != 0) {
+                perror("ERROR pthread_setaffinity_np");
+            }
+        }
+    }
+
+    int next = 0;
+    while (1) {
+        struct sockaddr_in cli_addr;
+        socklen_t clilen = sizeof(cli_addr);
+
+        int newsockfd = accept(sockfd, (struct sockaddr *)&cli_addr, &clilen);
+        if (newsockfd < 0) {
+            if (errno == EINTR) {
+                if (draining) break;
+                continue;
+            }
+            die("ERROR on accept");
+        }
+
+        apply_conn_tuning(newsockfd);
+        stats_add_conn();
+        live_conns++;
+        fd_queue_push(&queues[next], newsockfd, &cli_addr);
+        next = (next + 1) % nthreads;
+    }
+
+    /* Drain: stop accepting and wait for queued and in-flight
+     * connections to finish; workers decrement the counter on close. */
+    close(sockfd);
+    printf("Server draining (pid %ld): no longer accepting\n", (long)getpid());
+    fflush(stdout);
+    while (atomic_load(&live_conns) > 0) {
+        usleep(50 * 1000);
+    }
+}
+
+/* ---- UDP datagram mode ---- */
+
+/*
+ * Fire-and-forget datagram path: no connections, no per-peer state.
+ * recvmmsg() pulls up to UDP_BATCH packets per syscall and sendmmsg()
+ * pushes the whole batch of replies back in one more, so the per-packet
+ * syscall cost collapses by the batch factor. Every datagram is treated
+ * like one text message: quit/exit answers "Bye." (there is nothing to
+ * close), everything else gets the ack header plus echo. Reply iovecs
+ * point straight into the receive slots, so nothing is copied.
+ */
+#define UDP_BATCH 64
+
+static void run_udp_loop(int portno) {
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) die("ERROR opening socket");
+
+    int optval = 1;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) {
+        die("ERROR setsockopt(SO_REUSEADDR)");
+    }
+    if (reuse_listener &&
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+        die("ERROR setsockopt(SO_REUSEPORT)");
+    }
+
+    struct sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = INADDR_ANY;
+    serv_addr.sin_port = htons((uint16_t)portno);
+    if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+        die("ERROR on binding");
+    }
+
+    /* One receive slot per batch entry; -b bounds the datagram size we
+     * accept (capped at what UDP can carry anyway). */
+    size_t slot = conn_bufsize < 65536 ? conn_bufsize : 65536;
+    char *rbuf = malloc(UDP_BATCH * slot);
+    if (rbuf == NULL) die("ERROR allocating datagram buffers");
+
+    struct mmsghdr rmsgs[UDP_BATCH], smsgs[UDP_BATCH];
+    struct iovec riov[UDP_BATCH], siov[2 * UDP_BATCH];
+    struct sockaddr_in addrs[UDP_BATCH];
+
+    while (!draining) {
+        for (int i = 0; i < UDP_BATCH; i++) {
+            riov[i].iov_base = rbuf + (size_t)i * slot;
+            riov[i].iov_len = slot - 1; /* room for the NUL */
+            memset(&rmsgs[i].msg_hdr, 0, sizeof(rmsgs[i].msg_hdr));
+            rmsgs[i].msg_hdr.msg_iov = &riov[i];
+            rmsgs[i].msg_hdr.msg_iovlen = 1;
+            rmsgs[i].msg_hdr.msg_name = &addrs[i];
+            rmsgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+
+        int n = recvmmsg(sockfd, rmsgs, UDP_BATCH, MSG_WAITFORONE, NULL);
+        if (n < 0) {
             if (errno == EINTR) continue;
+            die("ERROR recvmmsg");
+        }
+
+        int nout = 0;
+        uint64_t bytes_in = 0, bytes_out = 0;
+        for (int i = 0; i < n; i++) {
+            char *data = riov[i].iov_base;
+            size_t len = rmsgs[i].msg_len;
+            data[len] = '\0';
+            bytes_in += len;
+
+            log_write(LOG_MSG, "[pid %ld] udp msg -> %s%s",
+                      (long)getpid(), data,
+                      len > 0 && data[len - 1] == '\n' ? "" : "\n");
+
+            struct iovec *out = &siov[2 * nout];
+            int cnt;
+            if (is_quit_cmd(data)) {
+                out[0].iov_base = (void *)reply_bye;
+                out[0].iov_len = sizeof(reply_bye) - 1;
+                cnt = 1;
+            } else {
+                out[0].iov_base = (void *)reply_header;
+                out[0].iov_len = sizeof(reply_header) - 1;
+                out[1].iov_base = data;
+                out[1].iov_len = len;
+                cnt = 2;
+            }
+            memset(&smsgs[nout].msg_hdr, 0, sizeof(smsgs[nout].msg_hdr));
+            smsgs[nout].msg_hdr.msg_iov = out;
+            smsgs[nout].msg_hdr.msg_iovlen = (size_t)cnt;
+            smsgs[nout].msg_hdr.msg_name = &addrs[i];
+            smsgs[nout].msg_hdr.msg_namelen = rmsgs[i].msg_hdr.msg_namelen;
+            bytes_out += out[0].iov_len + (cnt == 2 ? out[1].iov_len : 0);
+            nout++;
+        }
+
+        int off = 0;
+        while (off < nout) {
+            int s = sendmmsg(sockfd, smsgs + off, (unsigned)(nout - off), 0);
+            if (s < 0) {
+                if (errno == EINTR) continue;
+                perror("ERROR sendmmsg");
+                break;
+            }
+            off += s;
+        }
+
+        if (n > 0) stats_add_msgs((uint64_t)n, bytes_in, bytes_out);
+    }
+
+    free(rbuf);
+    close(sockfd);
+}
+
+/* ---- io_uring mode ---- */
+
+/*
+ * Raw io_uring engine (no liburing dependency). One multishot accept
+ * covers the listen socket; each connection keeps exactly one recv or
+ * one send in flight, so submissions made while draining a batch of
+ * completions all leave in a single io_uring_enter() call.
+ */
+
+#define URING_ENTRIES 1024
+
+/* user_data encoding: fd in the high bits, operation in the low byte */
+enum uring_op {
+    UOP_ACCEPT = 1,
+    UOP_RECV = 2,
+    UOP_SEND = 3,
+    UOP_CANCEL = 4
+};
+
+struct uring {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sqe_tail_local; /* producer-side tail, published on flush */
+    unsigned submitted;      /* sqes already handed to the kernel */
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                              unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                        NULL, 0);
+}
+
+static void uring_init(struct uring *u) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    memset(u, 0, sizeof(*u));
+    u->ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    if (u->ring_fd < 0) die("ERROR io_uring_setup");
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_size > sq_size) sq_size = cq_size;
+        cq_size = sq_size;
+    }
+
+    void *sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) die("ERROR mmap sq ring");
+
+    void *cq_ptr = sq_ptr;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) die("ERROR mmap cq ring");
+    }
+
+    u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->ring_fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) die("ERROR mmap sqes");
+
+    u->sq_entries = p.sq_entries;
+    u->sq_head = (unsigned *)((char *)sq_ptr + p.sq_off.head);
+    u->sq_tail = (unsigned *)((char *)sq_ptr + p.sq_off.tail);
+    u->sq_mask = (unsigned *)((char *)sq_ptr + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)((char *)sq_ptr + p.sq_off.array);
+    u->cq_head = (unsigned *)((char *)cq_ptr + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)cq_ptr + p.cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)cq_ptr + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)cq_ptr + p.cq_off.cqes);
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *u) {
+    while (1) {
+        unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        if (u->sqe_tail_local - head < u->sq_entries) break;
+        /* SQ full: push what we have and let the kernel drain it */
+        __atomic_store_n(u->sq_tail, u->sqe_tail_local, __ATOMIC_RELEASE);
+        if (sys_io_uring_enter(u->ring_fd, u->sqe_tail_local - u->submitted,
+                               0, 0) < 0) {
+            die("ERROR io_uring_enter (sq full)");
+        }
+        u->submitted = u->sqe_tail_local;
+    }
+
+    unsigned idx = u->sqe_tail_local & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    u->sqe_tail_local++;
+    return sqe;
+}
+
+static void uring_submit_recv(struct uring *u, struct conn *c, int fd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)(c->inbuf + c->inlen);
+    sqe->len = (unsigned)(conn_bufsize - 1 - c->inlen);
+    sqe->user_data = ((unsigned long)fd << 8) | UOP_RECV;
+}
+
+static void uring_submit_send(struct uring *u, struct conn *c, int fd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)(c->outbuf + c->outoff);
+    sqe->len = (unsigned)(c->outlen - c->outoff);
+    sqe->user_data = ((unsigned long)fd << 8) | UOP_SEND;
+}
+
+static void uring_submit_accept(struct uring *u, int listenfd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = ((unsigned long)listenfd << 8) | UOP_ACCEPT;
+}
+
+/* Closing the listen fd does not stop a multishot accept (the op holds
+ * its own file reference), so draining cancels it explicitly. */
+static void uring_submit_cancel_accept(struct uring *u, int listenfd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = ((unsigned long)listenfd << 8) | UOP_ACCEPT;
+    sqe->user_data = ((unsigned long)listenfd << 8) | UOP_CANCEL;
+}
+
+static void uring_close_conn(struct conn *conns, int fd) {
+    if (conns[fd].active) live_conns--;
+    close(fd);
+    if (conns[fd].arena != NULL) arena_destroy(conns[fd].arena);
+    memset(&conns[fd], 0, sizeof(conns[fd]));
+}
+
+#if PROTO_HAS_TEXT
+/*
+ * Like process_frames(), but replies are staged into the connection's
+ * output buffer and sent with one IORING_OP_SEND, since iovecs handed to
+ * the kernel must stay stable until the send completes. Returns 1 to
+ * keep the connection, 0 to close it after the staged bytes are sent.
+ */
+static int uring_process_frames(struct conn *c, size_t outcap) {
+    size_t pos = 0;
+    int quit = 0;
+    uint64_t nmsgs = 0, nbytes_out = 0;
+
+    while (pos < c->inlen) {
+        char *start = c->inbuf + pos;
+        size_t avail = c->inlen - pos;
+        const char *nl = scan_find_byte(start, avail, '\n');
+        size_t msglen;
+
+        if (nl != NULL) {
+            msglen = (size_t)(nl - start) + 1;
+        } else if (pos == 0 && c->inlen == conn_bufsize - 1) {
+            msglen = avail;
+        } else {
+            break;
+        }
+
+        char saved = start[msglen];
+        start[msglen] = '\0';
+        log_write(LOG_MSG, "[pid %ld] msg from %s -> %s%s",
+                  (long)getpid(), c->peer, start,
+                  start[msglen - 1] == '\n' ? "" : "\n");
+        quit = is_quit_cmd(start);
+        start[msglen] = saved;
+
+        if (quit) break;
+
+        if (c->outlen + sizeof(reply_header) - 1 + msglen > outcap) break;
+        memcpy(c->outbuf + c->outlen, reply_header, sizeof(reply_header) - 1);
+        c->outlen += sizeof(reply_header) - 1;
+        memcpy(c->outbuf + c->outlen, start, msglen);
+        c->outlen += msglen;
+
+        nmsgs++;
+        nbytes_out += sizeof(reply_header) - 1 + msglen;
+        pos += msglen;
+    }
+
+    if (nmsgs > 0) stats_add_msgs(nmsgs, pos, nbytes_out);
+
+    if (quit) {
+        memcpy(c->outbuf + c->outlen, reply_bye, sizeof(reply_bye) - 1);
+        c->outlen += sizeof(reply_bye) - 1;
+        log_write(LOG_CONN, "[pid %ld] client disconnected (quit/exit): %s\n",
+                  (long)getpid(), c->peer);
+        return 0;
+    }
+
+    if (pos > 0 && pos < c->inlen) {
+        memmove(c->inbuf, c->inbuf + pos, c->inlen - pos);
+    }
+    c->inlen -= pos;
+    return 1;
+}
+
+#endif /* PROTO_HAS_TEXT */
+
+#if PROTO_HAS_BIN
+/*
+ * Binary-mode counterpart of uring_process_frames(): same frame handling
+ * as process_frames_bin(), but replies are staged into the connection's
+ * output buffer for a single IORING_OP_SEND.
+ */
+static int uring_process_frames_bin(struct conn *c, size_t outcap) {
+    size_t pos = 0;
+    int quit = 0;
+    uint64_t nmsgs = 0, nbytes_out = 0;
+
+    while (pos + sizeof(struct bin_hdr) <= c->inlen) {
+        struct bin_hdr hdr;
+        memcpy(&hdr, c->inbuf + pos, sizeof(hdr));
+
+        if (hdr.length > conn_bufsize - 1 - sizeof(hdr)) {
+            log_write(LOG_CONN, "[pid %ld] oversized frame (%u bytes) from %s\n",
+                      (long)getpid(), hdr.length, c->peer);
+            return 0;
+        }
+        if (pos + sizeof(hdr) + hdr.length > c->inlen) break;
+
+        char *payload = c->inbuf + pos + sizeof(hdr);
+
+        log_write(LOG_MSG, "[pid %ld] frame type %u len %u from %s\n",
+                  (long)getpid(), hdr.type, hdr.length, c->peer);
+
+        if (hdr.type == BIN_QUIT) {
+            quit = 1;
+            break;
+        }
+
+        int full = 0;
+        switch (hdr.type) {
+        case BIN_ECHO: {
+            struct bin_hdr reply = { BIN_ECHO, hdr.length };
+            if (c->outlen + sizeof(reply) + hdr.length > outcap) {
+                full = 1;
+                break;
+            }
+            memcpy(c->outbuf + c->outlen, &reply, sizeof(reply));
+            c->outlen += sizeof(reply);
+            memcpy(c->outbuf + c->outlen, payload, hdr.length);
+            c->outlen += hdr.length;
+            nbytes_out += sizeof(reply) + hdr.length;
+            break;
+        }
+        case BIN_PING:
+            if (c->outlen + sizeof(bin_pong) > outcap) {
+                full = 1;
+                break;
+            }
+            memcpy(c->outbuf + c->outlen, &bin_pong, sizeof(bin_pong));
+            c->outlen += sizeof(bin_pong);
+            nbytes_out += sizeof(bin_pong);
+            break;
+        case BIN_STATS: {
+            uint64_t vals[4];
+            if (c->outlen + sizeof(bin_stats_hdr) + sizeof(vals) > outcap) {
+                full = 1;
+                break;
+            }
+            stats_snapshot(vals);
+            memcpy(c->outbuf + c->outlen, &bin_stats_hdr, sizeof(bin_stats_hdr));
+            c->outlen += sizeof(bin_stats_hdr);
+            memcpy(c->outbuf + c->outlen, vals, sizeof(vals));
+            c->outlen += sizeof(vals);
+            nbytes_out += sizeof(bin_stats_hdr) + sizeof(vals);
+            break;
+        }
+        default:
+            log_write(LOG_CONN, "[pid %ld] unknown frame type %u from %s\n",
+                      (long)getpid(), hdr.type, c->peer);
+            return 0;
+        }
+        if (full) break; /* staging buffer full; resume after the send */
+
+        nmsgs++;
+        pos += sizeof(hdr) + hdr.length;
+    }
+
+    if (nmsgs > 0) stats_add_msgs(nmsgs, pos, nbytes_out);
+
+    if (quit) {
+        memcpy(c->outbuf + c->outlen, &bin_bye, sizeof(bin_bye));
+        c->outlen += sizeof(bin_bye);
+        log_write(LOG_CONN, "[pid %ld] client disconnected (QUIT frame): %s\n",
+                  (long)getpid(), c->peer);
+        return 0;
+    }
+
+    if (pos > 0 && pos < c->inlen) {
+        memmove(c->inbuf, c->inbuf + pos, c->inlen - pos);
+    }
+    c->inlen -= pos;
+    return 1;
+}
+#endif /* PROTO_HAS_BIN */
+
+static void run_uring_loop(int sockfd) {
+    size_t max_fds;
+    struct conn *conns = conn_table_create(&max_fds);
+
+    /* Worst case is a buffer of 1-byte lines: each 2 input bytes expand
+     * to a reply header plus the echo, so ~11x is a safe staging bound. */
+    size_t outcap = conn_bufsize * 11;
+
+    struct uring u;
+    uring_init(&u);
+    uring_submit_accept(&u, sockfd);
+
+    int listening = 1;
+    while (1) {
+        if (draining) {
+            if (listening) {
+                uring_submit_cancel_accept(&u, sockfd);
+                listening = 0;
+                log_write(LOG_CONN, "[pid %ld] draining: stopped accepting\n",
+                          (long)getpid());
+            }
+            if (atomic_load(&live_conns) == 0) break;
+        }
+
+        __atomic_store_n(u.sq_tail, u.sqe_tail_local, __ATOMIC_RELEASE);
+        int ret = sys_io_uring_enter(u.ring_fd, u.sqe_tail_local - u.submitted,
+                                     1, IORING_ENTER_GETEVENTS);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            die("ERROR io_uring_enter");
+        }
+        u.submitted = u.sqe_tail_local;
+
+        unsigned head = *u.cq_head;
+        unsigned tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &u.cqes[head & *u.cq_mask];
+            int fd = (int)(cqe->user_data >> 8);
+            int op = (int)(cqe->user_data & 0xff);
+            int res = cqe->res;
+
+            switch (op) {
+            case UOP_ACCEPT: {
+                if (!(cqe->flags & IORING_CQE_F_MORE) && !draining) {
+                    uring_submit_accept(&u, sockfd);
+                }
+                if (res < 0) {
+                    if (res != -ECANCELED) {
+                        errno = -res;
+                        perror("ERROR on accept");
+                    }
+                    break;
+                }
+                if (draining) {
+                    /* raced the cancel; the replacement owns new conns */
+                    close(res);
+                    break;
+                }
+                int newsockfd = res;
+                if ((size_t)newsockfd >= max_fds) {
+                    fprintf(stderr, "ERROR fd %d beyond connection table\n", newsockfd);
+                    close(newsockfd);
+                    break;
+                }
+
+                apply_conn_tuning(newsockfd);
+                stats_add_conn();
+
+                struct conn *c = &conns[newsockfd];
+                c->arena = arena_create(conn_bufsize + outcap);
+                if (c->arena == NULL) {
+                    perror("ERROR creating connection arena");
+                    close(newsockfd);
+                    break;
+                }
+                c->inbuf = arena_alloc(c->arena, conn_bufsize);
+                c->outbuf = arena_alloc(c->arena, outcap);
+                if (c->inbuf == NULL || c->outbuf == NULL) {
+                    perror("ERROR allocating connection buffers");
+                    uring_close_conn(conns, newsockfd);
+                    break;
+                }
+                c->inlen = 0;
+                c->incap = conn_bufsize; /* uring buffers are not adaptive */
+                c->outlen = 0;
+                c->outoff = 0;
+                c->closing = 0;
+                c->active = 1;
+                live_conns++;
+
+                socklen_t alen = sizeof(c->addr);
+                if (getpeername(newsockfd, (struct sockaddr *)&c->addr, &alen) == 0) {
+                    format_peer(&c->addr, c->peer, sizeof(c->peer));
+                } else {
+                    snprintf(c->peer, sizeof(c->peer), "?");
+                }
+                log_write(LOG_CONN, "[pid %ld] connected: %s\n",
+                          (long)getpid(), c->peer);
+
+                uring_submit_recv(&u, c, newsockfd);
+                break;
+            }
+            case UOP_RECV: {
+                struct conn *c = &conns[fd];
+                if (!c->active) break;
+                if (res <= 0) {
+                    if (res < 0) {
+                        errno = -res;
+                        perror("ERROR reading from socket");
+                    } else {
+                        log_write(LOG_CONN, "[pid %ld] client disconnected: %s\n",
+                                  (long)getpid(), c->peer);
+                    }
+                    uring_close_conn(conns, fd);
+                    break;
+                }
+
+                c->inlen += (size_t)res;
+                if (c->proto == PROTO_UNKNOWN) {
+                    c->proto = negotiate_proto(c->inbuf, &c->inlen);
+                }
+#if PROTO_HAS_BIN && PROTO_HAS_TEXT
+                if (c->proto == PROTO_BIN) {
+                    if (!uring_process_frames_bin(c, outcap)) c->closing = 1;
+                } else if (c->proto == PROTO_TEXT) {
+                    if (!uring_process_frames(c, outcap)) c->closing = 1;
+                }
+#elif PROTO_HAS_BIN
+                if (c->proto == PROTO_BIN &&
+                    !uring_process_frames_bin(c, outcap)) {
+                    c->closing = 1;
+                }
+#else
+                if (c->proto == PROTO_TEXT &&
+                    !uring_process_frames(c, outcap)) {
+                    c->closing = 1;
+                }
+#endif
+
+                if (c->outlen > 0) {
+                    /* recv is re-armed once the staged bytes are out */
+                    uring_submit_send(&u, c, fd);
+                } else if (c->closing) {
+                    uring_close_conn(conns, fd);
+                } else {
+                    uring_submit_recv(&u, c, fd);
+                }
+                break;
+            }
+            case UOP_SEND: {
+                struct conn *c = &conns[fd];
+                if (!c->active) break;
+                if (res < 0) {
+                    errno = -res;
+                    perror("ERROR writing to socket");
+                    uring_close_conn(conns, fd);
+                    break;
+                }
+
+                c->outoff += (size_t)res;
+                if (c->outoff < c->outlen) {
+                    uring_submit_send(&u, c, fd);
+                    break;
+                }
+
+                c->outlen = 0;
+                c->outoff = 0;
+                if (c->closing) {
+                    uring_close_conn(conns, fd);
+                } else {
+                    uring_submit_recv(&u, c, fd);
+                }
+                break;
+            }
+            case UOP_CANCEL:
+                break; /* nothing to do; the accept CQE carries the result */
+            }
+
+            head++;
+        }
+
+        __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+static void report_stats(int signo) {
+    (void)signo;
+    stats_report(STDOUT_FILENO);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-m fork|epoll|prefork|thread|uring|udp] [-w workers]\n"
+            "          [-b bufsize]\n"
+            "          [-l loglevel] [-t idle-timeout] [-z] [-a] [-r] [--backlog n]\n"
+            "          [--nodelay]\n"
+            "          [--quickack] [--keepalive] [--sockbuf bytes] <port>\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int sockfd;
+    int portno;
+    enum server_mode mode = MODE_FORK;
+    int nworkers = 0;
+
+    static const struct option long_opts[] = {
+        { "backlog", required_argument, NULL, 1000 },
+        { "nodelay", no_argument, NULL, 1001 },
+        { "quickack", no_argument, NULL, 1002 },
+        { "keepalive", no_argument, NULL, 1003 },
+        { "sockbuf", required_argument, NULL, 1004 },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "m:w:b:l:t:zar", long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "fork") == 0) mode = MODE_FORK;
+            else if (strcmp(optarg, "epoll") == 0) mode = MODE_EPOLL;
+            else if (strcmp(optarg, "prefork") == 0) mode = MODE_PREFORK;
+            else if (strcmp(optarg, "thread") == 0) mode = MODE_THREAD;
+            else if (strcmp(optarg, "uring") == 0) mode = MODE_URING;
+            else if (strcmp(optarg, "udp") == 0) mode = MODE_UDP;
+            else usage(argv[0]);
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            if (nworkers <= 0) usage(argv[0]);
+            break;
+        case 'b': {
+            long sz = atol(optarg);
+            if (sz < 512) usage(argv[0]);
+            conn_bufsize = (size_t)sz;
+            break;
+        }
+        case 'l': {
+            int lvl = atoi(optarg);
+            if (lvl < LOG_QUIET || lvl > LOG_MSG) usage(argv[0]);
+            log_set_level(lvl);
+            break;
+        }
+        case 't':
+            idle_timeout = atoi(optarg);
+            if (idle_timeout < 0) usage(argv[0]);
+            break;
+        case 'z':
+            zero_copy_echo = 1;
+            break;
+        case 'a':
+            pin_workers = 1;
+            break;
+        case 'r':
+            reuse_listener = 1;
+            break;
+        case 1000:
+            tuning.backlog = atoi(optarg);
+            if (tuning.backlog <= 0) usage(argv[0]);
+            break;
+        case 1001:
+            tuning.nodelay = 1;
+            break;
+        case 1002:
+            tuning.quickack = 1;
+            break;
+        case 1003:
+            tuning.keepalive = 1;
+            break;
+        case 1004:
+            tuning.sockbuf = atoi(optarg);
+            if (tuning.sockbuf <= 0) usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "ERROR, no port provided\n");
+        usage(argv[0]);
+    }
+    /* Any non-digit in the positional argument makes it a socket path. */
+    for (const char *p = argv[optind]; *p; p++) {
+        if (*p < '0' || *p > '9') {
+            unix_path = argv[optind];
+            break;
+        }
+    }
+    portno = unix_path ? 0 : atoi(argv[optind]);
+
+    if (unix_path != NULL &&
+        (mode == MODE_PREFORK || mode == MODE_UDP || reuse_listener)) {
+        fprintf(stderr, "ERROR, prefork/udp/-r need SO_REUSEPORT or UDP; "
+                        "not available on unix sockets\n");
+        exit(1);
+    }
+
+    scan_init();
+
+    /* Shared stats region must exist before any worker forks. Slots are
+     * sized generously; extra workers just share slot 0. */
+    stats_init(256);
+
+    struct sigaction sa_stats;
+    memset(&sa_stats, 0, sizeof(sa_stats));
+    sa_stats.sa_handler = report_stats;
+    sa_stats.sa_flags = SA_RESTART;
+    sigemptyset(&sa_stats.sa_mask);
+    if (sigaction(SIGUSR1, &sa_stats, NULL) < 0) die("ERROR sigaction(SIGUSR1)");
+
+    /* A peer that closes while a reply is in flight must surface as an
+     * EPIPE from the write, not as a fatal signal. Unix-domain sockets
+     * raise SIGPIPE on the very first such write, where TCP usually
+     * softens the race into ECONNRESET. */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* SIGTERM starts a drain. Deliberately no SA_RESTART: the blocking
+     * accept/epoll_wait/io_uring_enter calls must wake with EINTR. */
+    struct sigaction sa_drain;
+    memset(&sa_drain, 0, sizeof(sa_drain));
+    sa_drain.sa_handler = handle_drain;
+    sigemptyset(&sa_drain.sa_mask);
+    if (sigaction(SIGTERM, &sa_drain, NULL) < 0) die("ERROR sigaction(SIGTERM)");
+
+    if (zero_copy_echo && mode != MODE_FORK && mode != MODE_THREAD) {
+        fprintf(stderr, "ERROR, -z requires a blocking per-connection mode (fork or thread)\n");
+        exit(1);
+    }
+
+    if (mode == MODE_UDP) {
+        printf("Server listening on udp port %d (pid %ld)\n",
+               portno, (long)getpid());
+        fflush(stdout);
+        log_init();
+        run_udp_loop(portno);
+        return 0;
+    }
+
+    if (mode == MODE_PREFORK) {
+        if (nworkers == 0) {
+            long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+            nworkers = (ncpu > 0) ? (int)ncpu : 1;
+        }
+        printf("Server preforking %d workers on port %d (pid %ld)\n",
+               nworkers, portno, (long)getpid());
+        fflush(stdout);
+        run_prefork_pool(portno, nworkers);
+        return 0;
+    }
+
+    sockfd = unix_path ? create_listen_socket_unix(unix_path)
+                       : create_listen_socket(portno, reuse_listener);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = reap_children;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGCHLD, &sa, NULL) < 0) die("ERROR sigaction(SIGCHLD)");
+
+    if (unix_path != NULL) {
+        printf("Server listening on %s (pid %ld, mode %s)\n",
+               unix_path, (long)getpid(),
+               mode == MODE_EPOLL ? "epoll" : mode == MODE_THREAD ? "thread"
+                   : mode == MODE_URING ? "uring" : "fork");
+    } else {
+        printf("Server listening on port %d (pid %ld, mode %s)\n",
+               portno, (long)getpid(),
+               mode == MODE_EPOLL ? "epoll" : mode == MODE_THREAD ? "thread"
+                   : mode == MODE_URING ? "uring" : "fork");
+    }
+    fflush(stdout);
+
+    if (mode == MODE_EPOLL) {
+        log_init();
+        run_epoll_loop(sockfd);
+        return 0;
+    }
+
+    if (mode == MODE_URING) {
+        log_init();
+        run_uring_loop(sockfd);
+        return 0;
+    }
+
+    if (mode == MODE_THREAD) {
+        if (nworkers == 0) {
+            long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+            nworkers = (ncpu > 0) ? (int)ncpu : 1;
+        }
+        log_init();
+        run_thread_pool(sockfd, nworkers);
+        return 0;
+    }
+
+    while (1) {
+        struct sockaddr_in cli_addr;
+        socklen_t clilen = sizeof(cli_addr);
+
+        int newsockfd = accept(sockfd, (struct sockaddr *)&cli_addr, &clilen);
+        if (newsockfd < 0) {
+            if (errno == EINTR) {
+                if (draining) break;
+                continue;
+            }
             die("ERROR on accept");
         }
 
+        apply_conn_tuning(newsockfd);
+        stats_add_conn();
+
         pid_t pid = fork();
         if (pid < 0) {
             perror("ERROR on fork");
@@ -178,7 +2737,8 @@ int main(int argc, char *argv[]) {
 
         if (pid == 0) {
             close(sockfd);
-            handle_client_loop(newsockfd, &cli_addr);
+            if (zero_copy_echo) handle_client_splice(newsockfd, &cli_addr);
+            else handle_client_loop(newsockfd, &cli_addr);
             close(newsockfd);
             _exit(0);
         }
@@ -186,5 +2746,14 @@ int main(int argc, char *argv[]) {
         close(newsockfd);
     }
 
+    /* Drain: close the listener (a -r replacement can be serving
+     * already) and wait for the children to finish their clients. */
+    close(sockfd);
+    printf("Server draining (pid %ld): no longer accepting\n", (long)getpid());
+    fflush(stdout);
+    while (waitpid(-1, NULL, 0) > 0 || errno == EINTR) {
+        /* wait out the last child */
+    }
+
     return 0;
 }
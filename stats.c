@@ -0,0 +1,178 @@
+/*
+ * Shared-memory per-worker counters (see stats.h).
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "trace.h"
+
+#ifdef STAGE_TRACE
+/* log2 buckets: index = floor(log2(cycles)), value printed as 1<<index */
+#define STATS_TRACE_BUCKETS 64
+#endif
+
+/* One cache line per worker so concurrent updates never false-share. */
+struct stats_slot {
+    atomic_uint_fast64_t connections;
+    atomic_uint_fast64_t messages;
+    atomic_uint_fast64_t bytes_in;
+    atomic_uint_fast64_t bytes_out;
+#ifdef STAGE_TRACE
+    atomic_uint_fast64_t trace[TRACE_NSTAGES][STATS_TRACE_BUCKETS];
+#endif
+} __attribute__((aligned(64)));
+
+struct stats_region {
+    atomic_int next_slot;
+    int max_workers;
+    struct stats_slot slots[];
+};
+
+static struct stats_region *region;
+
+/* Slot index is per thread so the thread-pool mode also gets one slot
+ * per worker; forked workers inherit the variable and re-attach. */
+static __thread int my_slot;
+
+void stats_init(int max_workers) {
+    size_t size = sizeof(struct stats_region) +
+                  (size_t)max_workers * sizeof(struct stats_slot);
+    region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        perror("ERROR mmap stats region");
+        region = NULL;
+        return;
+    }
+    region->max_workers = max_workers;
+    atomic_store(&region->next_slot, 1); /* slot 0 belongs to the creator */
+    my_slot = 0;
+}
+
+void stats_attach(void) {
+    if (region == NULL) return;
+    int slot = atomic_fetch_add(&region->next_slot, 1);
+    if (slot >= region->max_workers) {
+        /* More workers than slots: fall back to sharing slot 0. The
+         * counters stay correct, only the padding benefit is lost. */
+        slot = 0;
+    }
+    my_slot = slot;
+}
+
+#ifdef STAGE_TRACE
+
+static const char *const trace_stage_names[TRACE_NSTAGES] = {
+    "read", "parse", "log", "build", "write"
+};
+
+void stats_trace_add(int stage, uint64_t cycles) {
+    if (region == NULL) return;
+    unsigned bucket = cycles ? 63u - (unsigned)__builtin_clzll(cycles) : 0;
+    atomic_fetch_add_explicit(&region->slots[my_slot].trace[stage][bucket],
+                              1, memory_order_relaxed);
+}
+
+/* Bucket whose cumulative count first crosses pct of total; the value
+ * reported is the bucket's lower bound, hence the ~ in the output. */
+static uint64_t trace_percentile(const uint64_t *buckets, uint64_t total,
+                                 int pct) {
+    uint64_t target = total * (uint64_t)pct / 100;
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < STATS_TRACE_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen > target) return (uint64_t)1 << b;
+    }
+    return 0;
+}
+
+static void trace_report(int fd) {
+    int used = atomic_load(&region->next_slot);
+    if (used > region->max_workers) used = region->max_workers;
+
+    for (int st = 0; st < TRACE_NSTAGES; st++) {
+        uint64_t agg[STATS_TRACE_BUCKETS];
+        uint64_t total = 0;
+        memset(agg, 0, sizeof(agg));
+        for (int i = 0; i < used; i++) {
+            for (unsigned b = 0; b < STATS_TRACE_BUCKETS; b++) {
+                agg[b] += atomic_load_explicit(&region->slots[i].trace[st][b],
+                                               memory_order_relaxed);
+                total += atomic_load_explicit(&region->slots[i].trace[st][b],
+                                              memory_order_relaxed);
+            }
+        }
+        if (total == 0) continue;
+
+        char buf[256];
+        int n = snprintf(buf, sizeof(buf),
+                         "[trace] %-5s %llu samples, p50 ~%llu cycles, "
+                         "p99 ~%llu cycles\n",
+                         trace_stage_names[st], (unsigned long long)total,
+                         (unsigned long long)trace_percentile(agg, total, 50),
+                         (unsigned long long)trace_percentile(agg, total, 99));
+        if (n > 0) {
+            ssize_t ignored = write(fd, buf, (size_t)n);
+            (void)ignored;
+        }
+    }
+}
+
+#endif /* STAGE_TRACE */
+
+void stats_add_conn(void) {
+    if (region == NULL) return;
+    atomic_fetch_add_explicit(&region->slots[my_slot].connections, 1,
+                              memory_order_relaxed);
+}
+
+void stats_add_msgs(uint64_t msgs, uint64_t bytes_in, uint64_t bytes_out) {
+    if (region == NULL) return;
+    struct stats_slot *s = &region->slots[my_slot];
+    atomic_fetch_add_explicit(&s->messages, msgs, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->bytes_in, bytes_in, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->bytes_out, bytes_out, memory_order_relaxed);
+}
+
+void stats_snapshot(uint64_t vals[4]) {
+    vals[0] = vals[1] = vals[2] = vals[3] = 0;
+    if (region == NULL) return;
+
+    int used = atomic_load(&region->next_slot);
+    if (used > region->max_workers) used = region->max_workers;
+
+    for (int i = 0; i < used; i++) {
+        struct stats_slot *s = &region->slots[i];
+        vals[0] += atomic_load_explicit(&s->connections, memory_order_relaxed);
+        vals[1] += atomic_load_explicit(&s->messages, memory_order_relaxed);
+        vals[2] += atomic_load_explicit(&s->bytes_in, memory_order_relaxed);
+        vals[3] += atomic_load_explicit(&s->bytes_out, memory_order_relaxed);
+    }
+}
+
+void stats_report(int fd) {
+    if (region == NULL) return;
+
+    uint64_t vals[4];
+    stats_snapshot(vals);
+    uint64_t conns = vals[0], msgs = vals[1], in = vals[2], out = vals[3];
+
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf),
+                     "[stats] connections %llu, messages %llu, "
+                     "bytes in %llu, bytes out %llu\n",
+                     (unsigned long long)conns, (unsigned long long)msgs,
+                     (unsigned long long)in, (unsigned long long)out);
+    if (n > 0) {
+        ssize_t ignored = write(fd, buf, (size_t)n);
+        (void)ignored;
+    }
+#ifdef STAGE_TRACE
+    trace_report(fd);
+#endif
+}
@@ -0,0 +1,36 @@
+/*
+ * Shared-memory server statistics.
+ *
+ * A MAP_SHARED region is created in main() before any worker is forked,
+ * so counters survive worker exit and aggregate across processes. Each
+ * worker attaches to its own cache-line-padded slot and updates it with
+ * relaxed atomics: no locks, and no false sharing between workers.
+ * SIGUSR1 makes the receiving process print an aggregate snapshot.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/* Create the shared region sized for max_workers slots and attach the
+ * calling process to slot 0. Must run before workers fork. */
+void stats_init(int max_workers);
+
+/* Claim the next free slot for the calling worker (process or thread).
+ * Forked children that never call this keep using the inherited slot. */
+void stats_attach(void);
+
+/* Hot-path increments; no-ops if stats_init() was never called. */
+void stats_add_conn(void);
+void stats_add_msgs(uint64_t msgs, uint64_t bytes_in, uint64_t bytes_out);
+
+/* Aggregate all slots into vals[0..3]: connections, messages, bytes in,
+ * bytes out. Zeroed if stats_init() was never called. */
+void stats_snapshot(uint64_t vals[4]);
+
+/* Aggregate all slots and write one human-readable snapshot to fd.
+ * Only uses async-signal-safe calls, so it may run from a handler. */
+void stats_report(int fd);
+
+#endif /* STATS_H */